@@ -1,118 +1,870 @@
 #include "filesys/cache.h"
 #include <list.h>
+#include <hash.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "threads/synch.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+
+/* Data blocks per page of cache memory. */
+#define SECTORS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Smallest capacity accepted, in sectors. */
+#define CACHE_MIN_SIZE 32
+
+/* State of a cache entry.  cache_lock is never held across disk
+   I/O; an entry being read or written is marked busy instead. */
+enum cache_state
+{
+  CACHE_FREE,             /* slot not holding a sector */
+  CACHE_LOADING,          /* being read from disk, data not valid yet */
+  CACHE_CLEAN,            /* same as disk */
+  CACHE_DIRTY,            /* newer than disk */
+  CACHE_WRITING           /* being written back, data readable but frozen */
+};
+
+/* 2Q queue holding a cache entry. */
+enum cache_queue
+{
+  QUEUE_A1IN,             /* referenced once, FIFO */
+  QUEUE_AM                /* re-referenced, LRU */
+};
 
-#define CACHE_SIZE 64
 struct cache_entry
 {
   void *data;             /* data in cache */
   disk_sector_t sector;   /* write sector of disk */
-  bool dirty;             /* dirty bit */
+  enum cache_state state; /* see above */
   bool access;            /* access bit using clock algorithm */
-  struct list_elem elem;
+  int pin_cnt;            /* number of cache_get() holders */
+  struct list_elem elem;  /* element of cache_list, or of free_list if free */
+  struct list_elem hash_elem; /* element of a cache_buckets list, keyed by sector */
+  enum cache_queue queue; /* 2Q queue */
+  struct list_elem q_elem;    /* element of a1in_list or am_list */
 };
 
-static int cache_count;
+/* Sector recently evicted from A1in, remembered by 2Q so that a
+   second reference soon after goes straight to Am. */
+struct cache_ghost
+{
+  disk_sector_t sector;
+  struct list_elem elem;      /* element of ghost_list or ghost_free */
+  struct list_elem hash_elem; /* element of a ghost_buckets list */
+};
 
 struct lock cache_lock;
 struct list cache_list;
+/* Sector -> cache_entry index of cache_list, and the same for the
+   2Q ghosts.  Both are fixed tables of buckets sized by
+   cache_init(), unlike <hash.h>, which allocates when it resizes:
+   cache_shrink() runs inside the page allocator, so dropping an
+   entry must not allocate or free memory. */
+static struct list *cache_buckets, *ghost_buckets;
+static size_t bucket_cnt;       /* power of 2 */
+static struct condition cache_cond; /* broadcast when an entry stops being busy or pinned */
 
-void cache_init(){
-  lock_init(&cache_lock);
-  list_init(&cache_list);
+/* Slot arena.  cache_init() allocates cache_capacity slots up
+   front, but their data blocks come one page (a chunk of
+   SECTORS_PER_PAGE slots) at a time: the cache grows while the
+   kernel pool has pages to spare and cache_shrink() gives
+   pages back under memory pressure.  A slot in a chunk that has
+   a page is either on cache_list or on free_list. */
+struct cache_chunk
+{
+  uint8_t *page;          /* data blocks, or NULL if not allocated */
+};
+
+/* Requested capacity in sectors (-cache=N), 0 to size the cache
+   from the kernel pool. */
+int cache_size;
+
+static int cache_capacity;      /* maximum number of slots */
+static int slot_count;          /* slots backed by a page */
+static struct cache_entry *cache_slots;
+static struct cache_chunk *cache_chunks;
+static struct list free_list;
+
+/* Replacement policy, set from the kernel command line. */
+enum cache_policy cache_policy = CACHE_CLOCK;
+
+/* 2Q state.  A1in holds at most a quarter of the slots, with
+   entries seen once, so a long scan only recycles A1in and never
+   pushes the reused blocks in Am out.  A1out (the ghosts)
+   remembers the sectors last evicted from A1in, as many as half
+   the capacity. */
+static struct list a1in_list, am_list;
+static int a1in_count;
+static struct cache_ghost *ghosts;
+static struct list ghost_list;  /* oldest first */
+static struct list ghost_free;
+
+static int dirty_count;         /* number of CACHE_DIRTY entries */
+static struct cache_stat stats; /* protected by cache_lock */
+static struct lock flush_lock;  /* serializes cache_flush() */
+static struct cache_entry **flush_buf; /* cache_capacity entries, for cache_flush() */
+
+/* Write-behind tuning, set from the kernel command line.
+   The flusher writes every dirty entry back each
+   cache_flush_interval milliseconds, or sooner once more than
+   cache_dirty_ratio percent of the cache is dirty. */
+int cache_flush_interval = 1000;
+int cache_dirty_ratio = 50;
+
+/* Wakes the flusher: up'd by the ticker thread each interval,
+   with flush_due set, and by cache_mark_dirty() when the dirty
+   ratio is crossed, with flush_wanted set so that it is up'd once
+   per crossing.  Both flags are under cache_lock. */
+static struct semaphore flush_sema;
+static bool flush_due, flush_wanted;
+
+/* Read-ahead requests waiting for the reader thread.  The queue
+   only holds hints, so a request is dropped when it is full. */
+#define READ_AHEAD_SIZE 64
+static disk_sector_t ra_queue[READ_AHEAD_SIZE];
+static int ra_head, ra_count;
+static struct lock ra_lock;
+static struct semaphore ra_sema;  /* Up'd once per queued request. */
+
+/* Flags for cache_get_entry(). */
+#define GET_LOAD 0x1            /* read a missing sector from disk */
+#define GET_EXCLUSIVE 0x2       /* caller is going to modify the data */
+#define GET_READ_AHEAD 0x4      /* request from the reader thread */
+
+/* Returns the CPU time stamp counter. */
+static inline uint64_t rdtsc(void){
+  uint64_t tsc;
+  asm volatile("rdtsc" : "=A" (tsc));
+  return tsc;
 }
 
-void cache_close(){
+/* Acquires cache_lock, accounting for the time spent waiting. */
+static void cache_lock_acquire(void){
+  uint64_t start;
+  if(lock_try_acquire(&cache_lock))
+    return;
+  start = rdtsc();
   lock_acquire(&cache_lock);
-  struct list_elem *e;
-  struct cache_entry *c;
-  while(!list_empty(&cache_list)){
-    e = list_pop_front(&cache_list);
-    c = list_entry(e, struct cache_entry, elem);
-    if(c->dirty)
-      disk_write(filesys_disk, c->sector, c->data);
-    free(c->data);
-    free(c);
+  stats.lock_waits++;
+  stats.lock_wait_cycles += rdtsc() - start;
+}
+
+/* Adds an operation that started at time stamp START to the
+   latency histogram.  Must be called with cache_lock held. */
+static void cache_account(uint64_t start){
+  uint64_t x = (rdtsc() - start) >> CACHE_HIST_SHIFT;
+  int bucket = 0;
+  while(x != 0 && bucket < CACHE_HIST_BUCKETS - 1){
+    x >>= 1;
+    bucket++;
   }
-  cache_count = 0;
-  lock_release(&cache_lock);
+  stats.latency[bucket]++;
 }
 
-void cache_read(disk_sector_t sector, void *buffer, off_t ofs, off_t size){
-  lock_acquire(&cache_lock);
-  struct cache_entry *c = NULL;
+/* Returns the bucket of SECTOR in table BUCKETS. */
+static struct list *cache_bucket(struct list *buckets, disk_sector_t sector){
+  return &buckets[hash_int(sector) & (bucket_cnt - 1)];
+}
+
+/* Returns the cache entry holding SECTOR, or NULL if SECTOR is
+   not cached.  Must be called with cache_lock held. */
+static struct cache_entry *cache_lookup(disk_sector_t sector){
+  struct list *bucket = cache_bucket(cache_buckets, sector);
   struct list_elem *e;
-  for(e = list_begin(&cache_list); e != list_end(&cache_list); e = list_next(e)){
-    c = list_entry(e, struct cache_entry, elem);
+  for(e = list_begin(bucket); e != list_end(bucket); e = list_next(e)){
+    struct cache_entry *c = list_entry(e, struct cache_entry, hash_elem);
     if(c->sector == sector)
-      break;
+      return c;
   }
-  if(e == list_end(&cache_list)){
-    if(cache_count == CACHE_SIZE)
-      cache_evict();
-    cache_count++;
-    c = malloc(sizeof(struct cache_entry));
-    c->data = malloc(DISK_SECTOR_SIZE);
-    c->dirty = 0;
-    c->sector = sector;
-    list_push_back(&cache_list, &c->elem);
-    disk_read(filesys_disk, c->sector, c->data);
+  return NULL;
+}
+
+/* Forgets SECTOR if it is in A1out.  Returns true if it was. */
+static bool ghost_remove(disk_sector_t sector){
+  struct list *bucket = cache_bucket(ghost_buckets, sector);
+  struct list_elem *e;
+  for(e = list_begin(bucket); e != list_end(bucket); e = list_next(e)){
+    struct cache_ghost *g = list_entry(e, struct cache_ghost, hash_elem);
+    if(g->sector == sector){
+      list_remove(&g->hash_elem);
+      list_remove(&g->elem);
+      list_push_back(&ghost_free, &g->elem);
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Remembers SECTOR in A1out, forgetting the oldest ghost if full. */
+static void ghost_add(disk_sector_t sector){
+  struct cache_ghost *g;
+  if(list_empty(&ghost_free)){
+    g = list_entry(list_pop_front(&ghost_list), struct cache_ghost, elem);
+    list_remove(&g->hash_elem);
   }
+  else
+    g = list_entry(list_pop_front(&ghost_free), struct cache_ghost, elem);
+  g->sector = sector;
+  list_push_back(&ghost_list, &g->elem);
+  list_push_front(cache_bucket(ghost_buckets, sector), &g->hash_elem);
+}
+
+/* Records a new entry C with the replacement policy. */
+static void cache_policy_insert(struct cache_entry *c){
+  c->access = 0;
+  if(cache_policy != CACHE_2Q)
+    return;
+  if(ghost_remove(c->sector)){
+    c->queue = QUEUE_AM;
+    list_push_back(&am_list, &c->q_elem);
+  }
+  else{
+    c->queue = QUEUE_A1IN;
+    list_push_back(&a1in_list, &c->q_elem);
+    a1in_count++;
+  }
+}
+
+/* Records a reference to C with the replacement policy.  2Q
+   ignores repeated references while C is still in A1in. */
+static void cache_touch(struct cache_entry *c){
   c->access = 1;
+  if(cache_policy == CACHE_2Q && c->queue == QUEUE_AM){
+    list_remove(&c->q_elem);
+    list_push_back(&am_list, &c->q_elem);
+  }
+}
 
-  memcpy(buffer, c->data+ofs, size);
-  lock_release(&cache_lock);
+/* Removes C, which is being evicted, from the replacement policy. */
+static void cache_policy_remove(struct cache_entry *c){
+  if(cache_policy != CACHE_2Q)
+    return;
+  list_remove(&c->q_elem);
+  if(c->queue == QUEUE_A1IN){
+    a1in_count--;
+    ghost_add(c->sector);
+  }
 }
 
-void cache_write(disk_sector_t sector, const void *buffer, off_t ofs, off_t size){
-  lock_acquire(&cache_lock);
-  struct cache_entry *c = NULL;
+static bool cache_busy(struct cache_entry *c){
+  return c->state == CACHE_LOADING || c->state == CACHE_WRITING;
+}
+
+/* Returns true if C may be chosen for eviction. */
+static bool cache_evictable(struct cache_entry *c){
+  return !cache_busy(c) && c->pin_cnt == 0;
+}
+
+/* Picks a victim with the clock algorithm. */
+static struct cache_entry *cache_victim_clock(void){
+  struct cache_entry *c, *first = NULL;
   struct list_elem *e;
   for(e = list_begin(&cache_list); e != list_end(&cache_list); e = list_next(e)){
     c = list_entry(e, struct cache_entry, elem);
-    if(c->sector == sector)
-      break;
+    if(!cache_evictable(c))
+      continue;
+    if(!c->access)
+      return c;
+    c->access = 0;
+    if(first == NULL)
+      first = c;
   }
-  if(e == list_end(&cache_list)){
-    if(cache_count == CACHE_SIZE)
-      cache_evict();
-    cache_count++;
-    c = malloc(sizeof(struct cache_entry));
-    c->data = malloc(DISK_SECTOR_SIZE);
-    c->sector = sector;
-    list_push_back(&cache_list, &c->elem);
-    if(ofs>0 || size<DISK_SECTOR_SIZE)
-      disk_read(filesys_disk, c->sector, c->data);
+  return first;
+}
+
+/* Returns the oldest evictable entry of 2Q queue LIST. */
+static struct cache_entry *cache_victim_queue(struct list *list){
+  struct list_elem *e;
+  for(e = list_begin(list); e != list_end(list); e = list_next(e)){
+    struct cache_entry *c = list_entry(e, struct cache_entry, q_elem);
+    if(cache_evictable(c))
+      return c;
   }
-  c->dirty = 1;
-  c->access = 1;
-  memcpy(c->data+ofs, buffer, size);
+  return NULL;
+}
+
+/* Picks a victim with 2Q: from A1in while it is over its share,
+   otherwise the least recently used entry of Am. */
+static struct cache_entry *cache_victim_2q(void){
+  struct cache_entry *c = NULL;
+  if(a1in_count > slot_count / 4)
+    c = cache_victim_queue(&a1in_list);
+  if(c == NULL)
+    c = cache_victim_queue(&am_list);
+  if(c == NULL)
+    c = cache_victim_queue(&a1in_list);
+  return c;
+}
+
+/* Takes a slot off cache_list and puts it back on free_list. */
+static void cache_drop(struct cache_entry *c){
+  cache_policy_remove(c);
+  list_remove(&c->elem);
+  list_remove(&c->hash_elem);
+  c->state = CACHE_FREE;
+  list_push_back(&free_list, &c->elem);
+}
+
+/* Adds one page of slots to the cache if the capacity allows and
+   the kernel pool has a page to spare.  Returns true if it did. */
+static bool cache_grow(void){
+  int i, j;
+  uint8_t *page;
+  if(slot_count == cache_capacity)
+    return false;
+  page = palloc_get_page(0);
+  if(page == NULL)
+    return false;
+  for(i=0;cache_chunks[i].page != NULL;i++)
+    continue;
+  cache_chunks[i].page = page;
+  for(j=0;j<SECTORS_PER_PAGE;j++){
+    struct cache_entry *c = &cache_slots[i * SECTORS_PER_PAGE + j];
+    c->data = page + j * DISK_SECTOR_SIZE;
+    c->state = CACHE_FREE;
+    list_push_back(&free_list, &c->elem);
+  }
+  slot_count += SECTORS_PER_PAGE;
+  return true;
+}
+
+static int cache_sector_cmp(const void *a, const void *b){
+  disk_sector_t x = (*(struct cache_entry * const *) a)->sector;
+  disk_sector_t y = (*(struct cache_entry * const *) b)->sector;
+  return x < y ? -1 : x > y;
+}
+
+/* Returns true if more than cache_dirty_ratio percent of the
+   cache is dirty. */
+static bool cache_over_ratio(void){
+  return dirty_count * 100 > cache_dirty_ratio * slot_count;
+}
+
+static void cache_mark_dirty(struct cache_entry *c){
+  if(c->state != CACHE_DIRTY){
+    c->state = CACHE_DIRTY;
+    dirty_count++;
+    if(!flush_wanted && cache_over_ratio()){
+      flush_wanted = true;
+      sema_up(&flush_sema);
+    }
+  }
+}
+
+/* Takes dirty entry C for write-back and appends it to BATCH. */
+static void cache_claim(struct cache_entry *c, struct cache_entry **batch, int *cnt){
+  ASSERT(c->state == CACHE_DIRTY);
+  c->state = CACHE_WRITING;
+  dirty_count--;
+  stats.write_backs++;
+  batch[(*cnt)++] = c;
+}
+
+/* Writes back the CNT entries of BATCH, all claimed with
+   cache_claim(), in ascending sector order so that the disk head
+   sweeps across the disk once.  Entries with consecutive sectors
+   form a run that is gathered into a page and written with a
+   single disk request, falling back to one request per sector if
+   no page is free.  Releases cache_lock during the transfers, so
+   the caller must revalidate anything it looked up. */
+static void cache_write_batch(struct cache_entry **batch, int cnt){
+  uint8_t *page;
+  int i, j, run;
+  qsort(batch, cnt, sizeof *batch, cache_sector_cmp);
   lock_release(&cache_lock);
+  page = palloc_get_page(0);
+  for(i=0;i<cnt;i+=run){
+    for(run=1;i+run<cnt && (page == NULL || run < SECTORS_PER_PAGE)
+              && batch[i+run]->sector == batch[i]->sector + run;run++)
+      continue;
+    if(page != NULL){
+      /* Entries being written back are frozen, so no lock is
+         needed to copy them. */
+      for(j=0;j<run;j++)
+        memcpy(page + j * DISK_SECTOR_SIZE, batch[i+j]->data, DISK_SECTOR_SIZE);
+      disk_write_multiple(filesys_disk, batch[i]->sector, run, page);
+    }
+    else
+      for(j=i;j<i+run;j++)
+        disk_write(filesys_disk, batch[j]->sector, batch[j]->data);
+    cache_lock_acquire();
+    for(j=i;j<i+run;j++)
+      batch[j]->state = CACHE_CLEAN;
+    cond_broadcast(&cache_cond, &cache_lock);
+    lock_release(&cache_lock);
+  }
+  palloc_free_page(page);
+  cache_lock_acquire();
 }
 
-void cache_evict(){
-  cache_count--;
+/* Most entries written back together with an evicted one. */
+#define EVICT_BATCH 16
+
+/* Writes back dirty entry C together with the dirty neighbours
+   around its sector, so that evicting from a sequentially written
+   file costs one sweep instead of a seek per sector. */
+static void cache_write_back(struct cache_entry *c){
+  struct cache_entry *batch[EVICT_BATCH], *n;
+  disk_sector_t sector = c->sector;
+  int cnt = 0;
+  cache_claim(c, batch, &cnt);
+  while(cnt < EVICT_BATCH / 2 && sector-- > 0
+        && (n = cache_lookup(sector)) != NULL
+        && n->state == CACHE_DIRTY && n->pin_cnt == 0)
+    cache_claim(n, batch, &cnt);
+  sector = c->sector;
+  while(cnt < EVICT_BATCH
+        && (n = cache_lookup(++sector)) != NULL
+        && n->state == CACHE_DIRTY && n->pin_cnt == 0)
+    cache_claim(n, batch, &cnt);
+  cache_write_batch(batch, cnt);
+}
+
+/* Picks a victim that is neither busy nor pinned with the
+   configured policy, or returns NULL if there is none. */
+static struct cache_entry *cache_victim(void){
+  return cache_policy == CACHE_2Q ? cache_victim_2q() : cache_victim_clock();
+}
+
+/* Tries to free one slot, choosing among entries that are
+   neither busy nor pinned with the configured policy.  A dirty
+   victim is only written back, along with its dirty neighbours,
+   which makes it clean for a later
+   pass; if no entry can be chosen, waits for one to settle.
+   Either way cache_lock may be released, so the caller must look
+   the cache up again afterwards. */
+static void cache_evict(void){
+  struct cache_entry *victim = cache_victim();
+  if(victim == NULL)
+    cond_wait(&cache_cond, &cache_lock);
+  else if(victim->state == CACHE_DIRTY)
+    cache_write_back(victim);
+  else{
+    cache_drop(victim);
+    stats.evictions++;
+  }
+}
+
+/* Puts uncached SECTOR in a free slot, growing the cache if it
+   may or else evicting a clean victim, and returns the new entry,
+   which is CACHE_LOADING until the caller fills it.  Returns NULL
+   if that would take a write-back or a wait; never does I/O, so
+   cache_lock stays held. */
+static struct cache_entry *cache_reserve(disk_sector_t sector){
+  struct cache_entry *c;
+  if(list_empty(&free_list) && !cache_grow()){
+    c = cache_victim();
+    if(c == NULL || c->state != CACHE_CLEAN)
+      return NULL;
+    cache_drop(c);
+    stats.evictions++;
+  }
+  c = list_entry(list_pop_front(&free_list), struct cache_entry, elem);
+  c->sector = sector;
+  c->pin_cnt = 0;
+  c->state = CACHE_LOADING;
+  list_push_back(&cache_list, &c->elem);
+  list_push_front(cache_bucket(cache_buckets, sector), &c->hash_elem);
+  cache_policy_insert(c);
+  return c;
+}
+
+/* Returns the entry for SECTOR.  On a miss the sector is read
+   from disk if FLAGS has GET_LOAD; otherwise the new entry's data
+   is undefined and the caller must overwrite all of it.  Waits
+   while the entry is loading and, with GET_EXCLUSIVE because the
+   caller will modify the data, while it is being written back.
+   Called and returns with cache_lock held, but may release it in
+   between. */
+static struct cache_entry *cache_get_entry(disk_sector_t sector, int flags){
   struct cache_entry *c;
+  for(;;){
+    c = cache_lookup(sector);
+    if(c != NULL){
+      if(c->state == CACHE_LOADING || ((flags & GET_EXCLUSIVE) && c->state == CACHE_WRITING)){
+        cond_wait(&cache_cond, &cache_lock);
+        continue;
+      }
+      if(!(flags & GET_READ_AHEAD))
+        stats.hits++;
+      return c;
+    }
+    c = cache_reserve(sector);
+    if(c == NULL){
+      cache_evict();
+      continue;
+    }
+    if(flags & GET_READ_AHEAD)
+      stats.read_aheads++;
+    else
+      stats.misses++;
+    if(flags & GET_LOAD){
+      lock_release(&cache_lock);
+      disk_read(filesys_disk, c->sector, c->data);
+      cache_lock_acquire();
+    }
+    c->state = CACHE_CLEAN;
+    cond_broadcast(&cache_cond, &cache_lock);
+    return c;
+  }
+}
+
+/* Writes the dirty entries back to disk as one sorted batch,
+   leaving them cached and clean.  Pinned entries may be modified
+   in place at any moment, so unless PINNED is true they wait for
+   the next flush. */
+static void cache_flush_dirty(bool pinned){
   struct list_elem *e;
+  int cnt = 0;
+  lock_acquire(&flush_lock);
+  cache_lock_acquire();
   for(e = list_begin(&cache_list); e != list_end(&cache_list); e = list_next(e)){
-    c = list_entry(e, struct cache_entry, elem);
-    if(!c->access){
-      list_remove(e);
-      if(c->dirty)
-        disk_write(filesys_disk, c->sector, c->data);
-      free(c->data);
-      free(c);
-      return ;
+    struct cache_entry *c = list_entry(e, struct cache_entry, elem);
+    if(c->state == CACHE_DIRTY && (pinned || c->pin_cnt == 0))
+      cache_claim(c, flush_buf, &cnt);
+  }
+  cache_write_batch(flush_buf, cnt);
+  lock_release(&cache_lock);
+  lock_release(&flush_lock);
+}
+
+/* Writes every unpinned dirty entry back to disk. */
+void cache_flush(){
+  cache_flush_dirty(false);
+}
+
+/* Write-behind thread.  Sleeps until the ticker or a crossing of
+   the dirty ratio wakes it.  Each interval it also pushes the free
+   map's pending changes into the cache first.  If pinned entries
+   keep the cache over the ratio after a flush, only the next
+   interval flushes again. */
+static void cache_flusher(void *aux UNUSED){
+  bool due;
+  for(;;){
+    sema_down(&flush_sema);
+    cache_lock_acquire();
+    due = flush_due;
+    flush_due = false;
+    lock_release(&cache_lock);
+    if(due)
+      free_map_flush();
+    cache_flush();
+    cache_lock_acquire();
+    flush_wanted = cache_over_ratio();
+    lock_release(&cache_lock);
+  }
+}
+
+/* Wakes the flusher every cache_flush_interval milliseconds. */
+static void cache_ticker(void *aux UNUSED){
+  int64_t ticks = (int64_t) cache_flush_interval * TIMER_FREQ / 1000;
+  for(;;){
+    timer_sleep(ticks > 0 ? ticks : 1);
+    cache_lock_acquire();
+    flush_due = true;
+    lock_release(&cache_lock);
+    sema_up(&flush_sema);
+  }
+}
+
+/* Read-ahead thread.  Serves queued sectors in FIFO order,
+   loading them without marking them accessed so that an unused
+   prefetch is evicted first. */
+static void cache_reader(void *aux UNUSED){
+  disk_sector_t sector;
+  for(;;){
+    sema_down(&ra_sema);
+    lock_acquire(&ra_lock);
+    sector = ra_queue[ra_head];
+    ra_head = (ra_head + 1) % READ_AHEAD_SIZE;
+    ra_count--;
+    lock_release(&ra_lock);
+
+    cache_lock_acquire();
+    cache_get_entry(sector, GET_LOAD | GET_READ_AHEAD);
+    lock_release(&cache_lock);
+  }
+}
+
+/* Asks the reader thread to bring SECTOR into the cache and
+   returns without waiting for it. */
+void cache_read_ahead(disk_sector_t sector){
+  lock_acquire(&ra_lock);
+  if(ra_count < READ_AHEAD_SIZE){
+    ra_queue[(ra_head + ra_count) % READ_AHEAD_SIZE] = sector;
+    ra_count++;
+    sema_up(&ra_sema);
+  }
+  lock_release(&ra_lock);
+}
+
+void cache_init(){
+  int i, kernel_sectors = palloc_kernel_pages() * SECTORS_PER_PAGE;
+  lock_init(&cache_lock);
+  lock_init(&flush_lock);
+  lock_init(&ra_lock);
+  cond_init(&cache_cond);
+  sema_init(&ra_sema, 0);
+  sema_init(&flush_sema, 0);
+  list_init(&cache_list);
+  list_init(&free_list);
+  list_init(&a1in_list);
+  list_init(&am_list);
+  list_init(&ghost_list);
+  list_init(&ghost_free);
+
+  /* By default the cache may take a quarter of the kernel pool,
+     and never more than half of it. */
+  cache_capacity = cache_size > 0 ? cache_size : kernel_sectors / 4;
+  if(cache_capacity > kernel_sectors / 2)
+    cache_capacity = kernel_sectors / 2;
+  if(cache_capacity < CACHE_MIN_SIZE)
+    cache_capacity = CACHE_MIN_SIZE;
+  cache_capacity = ROUND_UP(cache_capacity, SECTORS_PER_PAGE);
+
+  cache_slots = palloc_get_multiple(PAL_ASSERT | PAL_ZERO,
+                                    DIV_ROUND_UP(cache_capacity * sizeof *cache_slots, PGSIZE));
+  cache_chunks = calloc(cache_capacity / SECTORS_PER_PAGE, sizeof *cache_chunks);
+  flush_buf = malloc(cache_capacity * sizeof *flush_buf);
+  ghosts = malloc(cache_capacity / 2 * sizeof *ghosts);
+  for(bucket_cnt=1;bucket_cnt<(size_t)cache_capacity/2;bucket_cnt*=2)
+    continue;
+  cache_buckets = malloc(bucket_cnt * sizeof *cache_buckets);
+  ghost_buckets = malloc(bucket_cnt * sizeof *ghost_buckets);
+  if(cache_chunks == NULL || flush_buf == NULL || ghosts == NULL
+     || cache_buckets == NULL || ghost_buckets == NULL)
+    PANIC("buffer cache allocation failed");
+  for(i=0;i<(int)bucket_cnt;i++){
+    list_init(&cache_buckets[i]);
+    list_init(&ghost_buckets[i]);
+  }
+  for(i=0;i<cache_capacity/2;i++)
+    list_push_back(&ghost_free, &ghosts[i].elem);
+  while(slot_count < CACHE_MIN_SIZE)
+    if(!cache_grow())
+      PANIC("buffer cache allocation failed");
+  thread_create("cache_reader", PRI_DEFAULT, cache_reader, NULL);
+}
+
+/* Starts write-behind.  The flusher writes out the free map, so
+   this must wait until free_map_init() has run. */
+void cache_start_flusher(){
+  if(cache_flush_interval > 0){
+    thread_create("cache_flusher", PRI_DEFAULT, cache_flusher, NULL);
+    thread_create("cache_ticker", PRI_DEFAULT, cache_ticker, NULL);
+  }
+}
+
+void cache_close(){
+  struct cache_entry *c;
+  cache_flush_dirty(true);
+  cache_lock_acquire();
+  while(!list_empty(&cache_list)){
+    c = list_entry(list_front(&cache_list), struct cache_entry, elem);
+    if(cache_busy(c)){
+      cond_wait(&cache_cond, &cache_lock);
+      continue;
     }
-    else
-      c->access = 0;
+    if(c->state == CACHE_DIRTY){
+      /* Dirtied since the flush. */
+      lock_release(&cache_lock);
+      cache_flush_dirty(true);
+      cache_lock_acquire();
+      continue;
+    }
+    cache_drop(c);
+  }
+  lock_release(&cache_lock);
+}
+
+/* Returns true if every slot of chunk I is free, or clean and
+   neither busy nor pinned, so that its page can be released. */
+static bool cache_chunk_idle(int i){
+  int j;
+  for(j=0;j<SECTORS_PER_PAGE;j++){
+    struct cache_entry *c = &cache_slots[i * SECTORS_PER_PAGE + j];
+    if(c->state != CACHE_FREE && (c->state != CACHE_CLEAN || c->pin_cnt > 0))
+      return false;
+  }
+  return true;
+}
+
+/* Gives up to PAGE_CNT pages of cache memory back to the kernel
+   pool, dropping the clean entries that live in them, and returns
+   the number of pages released.  Called by the page allocator when
+   the kernel pool runs dry, possibly from malloc() with a
+   descriptor locked, so it never blocks, does I/O or allocates:
+   it gives up if cache_lock is not immediately available, and the
+   sector tables it drops entries from never resize. */
+size_t cache_shrink(size_t page_cnt){
+  size_t freed = 0;
+  int i, j;
+  if(cache_slots == NULL || lock_held_by_current_thread(&cache_lock)
+     || !lock_try_acquire(&cache_lock))
+    return 0;
+  for(i=0;i<cache_capacity/SECTORS_PER_PAGE && freed<page_cnt && slot_count>CACHE_MIN_SIZE;i++){
+    if(cache_chunks[i].page == NULL || !cache_chunk_idle(i))
+      continue;
+    for(j=0;j<SECTORS_PER_PAGE;j++){
+      struct cache_entry *c = &cache_slots[i * SECTORS_PER_PAGE + j];
+      if(c->state == CACHE_CLEAN){
+        cache_drop(c);
+        stats.evictions++;
+      }
+      list_remove(&c->elem);
+    }
+    palloc_free_page(cache_chunks[i].page);
+    cache_chunks[i].page = NULL;
+    slot_count -= SECTORS_PER_PAGE;
+    freed++;
+  }
+  lock_release(&cache_lock);
+  return freed;
+}
+
+void cache_read(disk_sector_t sector, void *buffer, off_t ofs, off_t size){
+  uint64_t start = rdtsc();
+  cache_lock_acquire();
+  struct cache_entry *c = cache_get_entry(sector, GET_LOAD);
+  cache_touch(c);
+  memcpy(buffer, c->data+ofs, size);
+  cache_account(start);
+  lock_release(&cache_lock);
+}
+
+/* Reads the CNT whole sectors starting at SECTOR into BUFFER.
+   Cached sectors are copied from the cache, waiting for those
+   still being loaded.  Each run of uncached ones is read with a
+   single disk request, straight into BUFFER if it is kernel
+   memory and otherwise through a bounce page, since a page fault
+   must not happen with the disk channel locked; the page is only
+   allocated once a run needs the disk.  The sectors of the run
+   are copied into cache slots where one is free or clean enough
+   to take without I/O, and skip the cache otherwise.  Those
+   entries are not marked accessed, like read-ahead, so a large
+   read that is never repeated is evicted first. */
+void cache_read_run(disk_sector_t sector, size_t cnt, void *buffer_){
+  struct cache_entry *run[SECTORS_PER_PAGE];
+  uint8_t *buffer = buffer_, *bounce = NULL, *dst;
+  bool direct = is_kernel_vaddr(buffer), tried = false;
+  uint64_t start = rdtsc();
+  size_t i = 0, n, j;
+  cache_lock_acquire();
+  while(i < cnt){
+    if(!direct && !tried && cache_lookup(sector + i) == NULL){
+      tried = true;
+      lock_release(&cache_lock);
+      bounce = palloc_get_page(0);
+      cache_lock_acquire();
+    }
+    n = 0;
+    if(direct || bounce != NULL)
+      for(; n < SECTORS_PER_PAGE && i + n < cnt && cache_lookup(sector + i + n) == NULL; n++)
+        run[n] = cache_reserve(sector + i + n);
+    if(n == 0){
+      struct cache_entry *c = cache_get_entry(sector + i, GET_LOAD);
+      cache_touch(c);
+      memcpy(buffer + i * DISK_SECTOR_SIZE, c->data, DISK_SECTOR_SIZE);
+      i++;
+      continue;
+    }
+    stats.misses += n;
+    lock_release(&cache_lock);
+    dst = direct ? buffer + i * DISK_SECTOR_SIZE : bounce;
+    disk_read_multiple(filesys_disk, sector + i, n, dst);
+    for(j=0;j<n;j++)
+      if(run[j] != NULL)
+        memcpy(run[j]->data, dst + j * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE);
+    cache_lock_acquire();
+    for(j=0;j<n;j++)
+      if(run[j] != NULL)
+        run[j]->state = CACHE_CLEAN;
+    cond_broadcast(&cache_cond, &cache_lock);
+    if(!direct){
+      /* BUFFER is user memory, so copy without cache_lock. */
+      lock_release(&cache_lock);
+      memcpy(buffer + i * DISK_SECTOR_SIZE, bounce, n * DISK_SECTOR_SIZE);
+      cache_lock_acquire();
+    }
+    i += n;
   }
-  c = list_entry(list_pop_front(&cache_list), struct cache_entry, elem);
-  if(c->dirty)
-    disk_write(filesys_disk, c->sector, c->data);
-  free(c->data);
-  free(c);
+  cache_account(start);
+  lock_release(&cache_lock);
+  palloc_free_page(bounce);
+}
+
+void cache_write(disk_sector_t sector, const void *buffer, off_t ofs, off_t size){
+  uint64_t start = rdtsc();
+  cache_lock_acquire();
+  struct cache_entry *c = cache_get_entry(sector, (ofs>0 || size<DISK_SECTOR_SIZE ? GET_LOAD : 0) | GET_EXCLUSIVE);
+  cache_mark_dirty(c);
+  cache_touch(c);
+  memcpy(c->data+ofs, buffer, size);
+  cache_account(start);
+  lock_release(&cache_lock);
+}
+
+/* Pins SECTOR in the cache, reading it in if needed, and returns
+   a handle whose cache_data() may be read and modified in place
+   without copying.  The entry is neither evicted nor written back
+   until it is released with cache_put(). */
+struct cache_entry *cache_get(disk_sector_t sector){
+  uint64_t start = rdtsc();
+  cache_lock_acquire();
+  struct cache_entry *c = cache_get_entry(sector, GET_LOAD | GET_EXCLUSIVE);
+  c->pin_cnt++;
+  cache_touch(c);
+  cache_account(start);
+  lock_release(&cache_lock);
+  return c;
+}
+
+/* Returns the DISK_SECTOR_SIZE bytes of data pinned by C. */
+void *cache_data(struct cache_entry *c){
+  ASSERT(c->pin_cnt > 0);
+  return c->data;
+}
+
+/* Unpins C, marking it dirty if the holder modified its data. */
+void cache_put(struct cache_entry *c, bool dirty){
+  cache_lock_acquire();
+  ASSERT(c->pin_cnt > 0);
+  if(dirty)
+    cache_mark_dirty(c);
+  if(--c->pin_cnt == 0)
+    cond_broadcast(&cache_cond, &cache_lock);
+  lock_release(&cache_lock);
+}
+
+/* Copies the current cache statistics into *STAT, which must be
+   kernel memory, since cache_lock is held meanwhile. */
+void cache_get_stat(struct cache_stat *stat){
+  cache_lock_acquire();
+  *stat = stats;
+  lock_release(&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void cache_print_stats(){
+  struct cache_stat s;
+  int i;
+  cache_get_stat(&s);
+  printf("Cache: %d of %d sectors allocated\n", slot_count, cache_capacity);
+  printf("Cache: %llu hits, %llu misses, %llu read-aheads, %llu evictions, %llu write-backs\n",
+         s.hits, s.misses, s.read_aheads, s.evictions, s.write_backs);
+  printf("Cache: %llu lock waits, %llu cycles waiting\n", s.lock_waits, s.lock_wait_cycles);
+  printf("Cache latency:");
+  for(i=0;i<CACHE_HIST_BUCKETS;i++)
+    if(s.latency[i] != 0)
+      printf(" %s%lu:%llu", i == CACHE_HIST_BUCKETS - 1 ? ">=" : "<",
+             1ul << (i + CACHE_HIST_SHIFT - (i == CACHE_HIST_BUCKETS - 1)), s.latency[i]);
+  printf(" cycles\n");
 }
@@ -2,13 +2,44 @@
 #define FILESYS_CACHE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <cache-stat.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 
+/* Buffer cache capacity in sectors (-cache=N), 0 for automatic. */
+extern int cache_size;
+
+/* Buffer cache replacement policy (-cache-policy=clock|2q). */
+enum cache_policy
+  {
+    CACHE_CLOCK,            /* Second chance. */
+    CACHE_2Q                /* Scan resistant 2Q. */
+  };
+extern enum cache_policy cache_policy;
+
+/* Write-behind tuning (-flush=MS, -dirty=PCT).
+   A flush interval of 0 disables the flusher thread. */
+extern int cache_flush_interval;
+extern int cache_dirty_ratio;
+
 void cache_init(void);
+void cache_start_flusher(void);
 void cache_close(void);
+size_t cache_shrink(size_t page_cnt);
+void cache_flush(void);
 void cache_read(disk_sector_t sector, void *buffer, off_t ofs, off_t size);
+void cache_read_run(disk_sector_t sector, size_t cnt, void *buffer);
 void cache_write(disk_sector_t sector, const void *buffer, off_t ofs, off_t size);
-void cache_evict(void);
+void cache_read_ahead(disk_sector_t sector);
+
+/* Zero-copy access to a pinned cache block. */
+struct cache_entry;
+struct cache_entry *cache_get(disk_sector_t sector);
+void *cache_data(struct cache_entry *c);
+void cache_put(struct cache_entry *c, bool dirty);
+
+void cache_get_stat(struct cache_stat *stat);
+void cache_print_stats(void);
 
 #endif
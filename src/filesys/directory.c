@@ -1,10 +1,13 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 
 /* A directory. */
@@ -22,6 +25,216 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Serializes changes to directory contents, so that checking
+   for a name and adding it, or checking that a directory is
+   empty and removing it, are atomic. */
+static struct lock dir_lock;
+
+/* Guards the layout of directories against dir_lookup() and
+   dir_readdir(), which do not take dir_lock: they hold the read
+   side while they search, and dir_hash() and dir_split() the
+   write side while they move entries around.  Directories share
+   these locks by sector. */
+#define LAYOUT_LOCK_CNT 16
+static struct rwlock layout_locks[LAYOUT_LOCK_CNT];
+
+/* Returns the layout lock of DIR. */
+static struct rwlock *
+layout_lock (const struct dir *dir)
+{
+  return &layout_locks[inode_get_inumber (dir->inode) % LAYOUT_LOCK_CNT];
+}
+
+/* A directory starts out as a plain array of entries.  Once it
+   outgrows DIR_HASH_MIN entries it is converted to the hashed
+   format: an array of buckets, one per sector, each holding
+   BUCKET_ENTRIES entries.  A name lives in bucket
+   hash_string(NAME) modulo the number of buckets, a power of 2,
+   so finding it reads a single sector.  When a bucket fills up,
+   the number of buckets doubles, splitting every bucket in two.
+   The inode records the number of buckets, which only changes
+   once every sector of the new layout has disk space, so running
+   out of space leaves the old layout intact.  Sectors past the
+   last bucket, left over from such a failure, hold no entries. */
+#define BUCKET_ENTRIES (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+#define DIR_HASH_MIN 64
+#define DIR_BUCKETS_MAX 4096
+
+/* Returns the number of buckets of hashed DIR. */
+static size_t
+bucket_cnt (const struct dir *dir)
+{
+  return inode_buckets (dir->inode);
+}
+
+/* Returns the bucket of NAME among BUCKETS buckets. */
+static size_t
+bucket_of (const char *name, size_t buckets)
+{
+  return hash_string (name) & (buckets - 1);
+}
+
+/* Returns OFS, or if DIR is hashed and there is no room for an
+   entry at OFS in its bucket, the start of the next bucket. */
+static off_t
+next_slot (const struct dir *dir, off_t ofs)
+{
+  if (inode_is_hashed (dir->inode)
+      && ofs % DISK_SECTOR_SIZE >= (off_t) (BUCKET_ENTRIES * sizeof (struct dir_entry)))
+    ofs = ROUND_UP (ofs, DISK_SECTOR_SIZE);
+  return ofs;
+}
+
+/* Name cache: the outcome of recent lookups of a name in a
+   directory, keyed by the directory's sector and the name.  A
+   CHILD of 0 records that the directory has no such name.
+   dir_add() and dir_remove() drop the entries they make stale and
+   bump dcache_gen, as do dir_hash() and dir_split() before they
+   move any entry, so that a lookup that raced with them does not
+   cache what it found. */
+#define DCACHE_SIZE 64
+
+struct dcache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache_table. */
+    struct list_elem elem;              /* Element in dcache_lru. */
+    bool in_table;                      /* In dcache_table? */
+    disk_sector_t parent;               /* Directory searched. */
+    char name[NAME_MAX + 1];            /* Name searched for. */
+    disk_sector_t child;                /* Inode found, or 0. */
+  };
+
+static struct dcache_entry dcache[DCACHE_SIZE];
+static struct hash dcache_table;
+static struct list dcache_lru;          /* Least recently used first. */
+static struct lock dcache_lock;
+static unsigned dcache_gen;
+
+static unsigned
+dcache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dcache_entry *d = hash_entry (e, struct dcache_entry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dcache_entry *a = hash_entry (a_, struct dcache_entry, hash_elem);
+  const struct dcache_entry *b = hash_entry (b_, struct dcache_entry, hash_elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Returns the cache entry for NAME in the directory in PARENT, or
+   a null pointer.  The caller holds dcache_lock. */
+static struct dcache_entry *
+dcache_find (disk_sector_t parent, const char *name)
+{
+  static struct dcache_entry key;       /* Under dcache_lock. */
+  struct hash_elem *e;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache_table, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory in PARENT in the name cache.
+   On a hit, sets *CHILD and returns true.  On a miss, sets *GEN
+   for passing to dcache_insert() and returns false. */
+static bool
+dcache_lookup (disk_sector_t parent, const char *name,
+               disk_sector_t *child, unsigned *gen)
+{
+  struct dcache_entry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d != NULL)
+    {
+      *child = d->child;
+      list_remove (&d->elem);
+      list_push_back (&dcache_lru, &d->elem);
+    }
+  else
+    *gen = dcache_gen;
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in the directory in PARENT is CHILD, unless
+   a directory changed since dcache_lookup() returned GEN. */
+static void
+dcache_insert (disk_sector_t parent, const char *name,
+               disk_sector_t child, unsigned gen)
+{
+  struct dcache_entry *d;
+
+  lock_acquire (&dcache_lock);
+  if (gen == dcache_gen && dcache_find (parent, name) == NULL)
+    {
+      d = list_entry (list_pop_front (&dcache_lru), struct dcache_entry, elem);
+      if (d->in_table)
+        hash_delete (&dcache_table, &d->hash_elem);
+      d->in_table = true;
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      d->child = child;
+      hash_insert (&dcache_table, &d->hash_elem);
+      list_push_back (&dcache_lru, &d->elem);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Makes lookups that started before now not cache what they
+   find, because a directory is about to change. */
+static void
+dcache_bump (void)
+{
+  lock_acquire (&dcache_lock);
+  dcache_gen++;
+  lock_release (&dcache_lock);
+}
+
+/* Forgets NAME in the directory in PARENT, which just changed. */
+static void
+dcache_invalidate (disk_sector_t parent, const char *name)
+{
+  struct dcache_entry *d;
+
+  lock_acquire (&dcache_lock);
+  dcache_gen++;
+  d = dcache_find (parent, name);
+  if (d != NULL)
+    {
+      hash_delete (&dcache_table, &d->hash_elem);
+      d->in_table = false;
+      list_remove (&d->elem);
+      list_push_front (&dcache_lru, &d->elem);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  size_t i;
+
+  lock_init (&dir_lock);
+  for (i = 0; i < LAYOUT_LOCK_CNT; i++)
+    rwlock_init (&layout_locks[i]);
+  lock_init (&dcache_lock);
+  if (!hash_init (&dcache_table, dcache_hash, dcache_less, NULL))
+    PANIC ("name cache creation failed");
+  list_init (&dcache_lru);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    list_push_back (&dcache_lru, &dcache[i].elem);
+}
+
 char *get_filename(const char *path){
   char *word, *brkt, *buffer = malloc(strlen(path)+1), *save, *file_name, *last = NULL;
   memcpy(buffer, path, strlen(path)+1);
@@ -102,7 +315,7 @@ struct dir *get_directory(const char *path, bool flag){
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt, disk_sector_t parent_sector)
 {
-  if(!inode_create (sector, entry_cnt * sizeof (struct dir_entry), INODE_MAX_LEVEL, true))
+  if(!inode_create (sector, entry_cnt * sizeof (struct dir_entry), true))
     return false;
   struct inode *inode = inode_open(sector);
   inode_set_parent(inode, parent_sector);
@@ -174,12 +387,18 @@ lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
-  size_t ofs;
+  off_t ofs = 0, end = inode_length (dir->inode);
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (inode_is_hashed (dir->inode))
+    {
+      /* Only NAME's bucket can hold it. */
+      ofs = bucket_of (name, bucket_cnt (dir)) * DISK_SECTOR_SIZE;
+      end = ofs + BUCKET_ENTRIES * sizeof e;
+    }
+  for (; ofs < end && inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
       {
@@ -209,14 +428,185 @@ dir_lookup (const struct dir *dir, const char *name,
     *inode = inode_reopen(dir->inode);
   else if(strcmp(name, "..") == 0)
     *inode = inode_open(inode_parent_number(dir->inode));
-  else if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
+  else if (strlen (name) > NAME_MAX)
     *inode = NULL;
+  else
+    {
+      disk_sector_t parent = inode_get_inumber (dir->inode), child;
+      unsigned gen;
+
+      if (!dcache_lookup (parent, name, &child, &gen))
+        {
+          rwlock_acquire_read (layout_lock (dir));
+          child = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+          rwlock_release_read (layout_lock (dir));
+          dcache_insert (parent, name, child, gen);
+        }
+      *inode = child != 0 ? inode_open (child) : NULL;
+    }
 
   return *inode != NULL;
 }
 
+/* Returns the offset of a free slot for NAME in DIR, which may be
+   the end of a plain directory, or -1 if NAME's bucket in a
+   hashed DIR is full.
+
+   inode_read_at() will only return a short read at end of file.
+   Otherwise, we'd need to verify that we didn't get a short
+   read due to something intermittent such as low memory. */
+static off_t
+free_slot (const struct dir *dir, const char *name)
+{
+  struct dir_entry e;
+  off_t ofs;
+
+  if (inode_is_hashed (dir->inode))
+    {
+      size_t i;
+      ofs = bucket_of (name, bucket_cnt (dir)) * DISK_SECTOR_SIZE;
+      for (i = 0; i < BUCKET_ENTRIES; i++, ofs += sizeof e)
+        if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e
+            || !e.in_use)
+          return ofs;
+      return -1;
+    }
+  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e) 
+    if (!e.in_use)
+      break;
+  return ofs;
+}
+
+/* Makes sure that sectors START up to END of DIR have disk space
+   by writing each back with its current contents, or zeros past
+   the end of file, using BUF as a sector of scratch space.  After
+   this, writing those sectors cannot fail.  Returns false if the
+   disk is full, leaving the entries of DIR unchanged, although
+   DIR may have grown. */
+static bool
+dir_reserve (struct dir *dir, size_t start, size_t end, void *buf)
+{
+  for (; start < end; start++)
+    {
+      memset (buf, 0, DISK_SECTOR_SIZE);
+      inode_read_at (dir->inode, buf, DISK_SECTOR_SIZE, start * DISK_SECTOR_SIZE);
+      if (inode_write_at (dir->inode, buf, DISK_SECTOR_SIZE,
+                          start * DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE)
+        return false;
+    }
+  return true;
+}
+
+/* Converts plain DIR to the hashed format, with enough buckets
+   that they are at most half full.  Returns true if successful,
+   false if memory or disk space runs out.  Holds DIR's layout
+   lock for writing throughout. */
+static bool
+dir_hash (struct dir *dir)
+{
+  off_t length = inode_length (dir->inode);
+  size_t cnt = length / sizeof (struct dir_entry);
+  struct dir_entry *old = malloc (length);
+  struct dir_entry *bucket = malloc (DISK_SECTOR_SIZE);
+  size_t buckets = 1, b, i, fill;
+  bool success = false;
+
+  rwlock_acquire_write (layout_lock (dir));
+  dcache_bump ();
+  if (old == NULL || bucket == NULL
+      || inode_read_at (dir->inode, old, length, 0) != length)
+    goto done;
+  while (buckets * BUCKET_ENTRIES < 2 * cnt
+         || buckets * DISK_SECTOR_SIZE < (size_t) length)
+    buckets *= 2;
+
+  /* Make sure that no bucket overflows. */
+ retry:
+  for (b = 0; b < buckets; b++)
+    {
+      for (fill = i = 0; i < cnt; i++)
+        if (old[i].in_use && bucket_of (old[i].name, buckets) == b)
+          fill++;
+      if (fill > BUCKET_ENTRIES)
+        {
+          buckets *= 2;
+          if (buckets > DIR_BUCKETS_MAX)
+            goto done;
+          goto retry;
+        }
+    }
+
+  /* The old entries are all in memory now.  Rewrite them as
+     buckets only once every bucket sector has space. */
+  if (!dir_reserve (dir, 0, buckets, bucket))
+    goto done;
+  for (b = 0; b < buckets; b++)
+    {
+      memset (bucket, 0, DISK_SECTOR_SIZE);
+      for (fill = i = 0; i < cnt; i++)
+        if (old[i].in_use && bucket_of (old[i].name, buckets) == b)
+          bucket[fill++] = old[i];
+      if (inode_write_at (dir->inode, bucket, DISK_SECTOR_SIZE,
+                          b * DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE)
+        goto done;
+    }
+  inode_set_buckets (dir->inode, buckets);
+  success = true;
+
+ done:
+  rwlock_release_write (layout_lock (dir));
+  free (old);
+  free (bucket);
+  return success;
+}
+
+/* Doubles the number of buckets of hashed DIR: the entries of
+   each bucket B that now hash to B plus the old number of buckets
+   move there.  Returns true if successful, false if DIR is too
+   big or memory or disk space runs out.  Holds DIR's layout lock
+   for writing throughout. */
+static bool
+dir_split (struct dir *dir)
+{
+  size_t buckets = bucket_cnt (dir), b, i;
+  struct dir_entry *keep = malloc (DISK_SECTOR_SIZE);
+  struct dir_entry *move = malloc (DISK_SECTOR_SIZE);
+  bool success = false;
+
+  rwlock_acquire_write (layout_lock (dir));
+  dcache_bump ();
+  if (buckets >= DIR_BUCKETS_MAX || keep == NULL || move == NULL
+      || !dir_reserve (dir, buckets, 2 * buckets, move))
+    goto done;
+  for (b = 0; b < buckets; b++)
+    {
+      if (inode_read_at (dir->inode, keep, DISK_SECTOR_SIZE,
+                         b * DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE)
+        goto done;
+      memset (move, 0, DISK_SECTOR_SIZE);
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (keep[i].in_use && bucket_of (keep[i].name, 2 * buckets) != b)
+          {
+            move[i] = keep[i];
+            keep[i].in_use = false;
+          }
+      if (inode_write_at (dir->inode, move, DISK_SECTOR_SIZE,
+                          (b + buckets) * DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE
+          || inode_write_at (dir->inode, keep, DISK_SECTOR_SIZE,
+                             b * DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE)
+        goto done;
+    }
+  inode_set_buckets (dir->inode, 2 * buckets);
+  success = true;
+
+ done:
+  rwlock_release_write (layout_lock (dir));
+  free (keep);
+  free (move);
+  return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -237,28 +627,35 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  lock_acquire (&dir_lock);
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+     current end-of-file, and a big plain directory is hashed
+     first.  A full bucket is split until it has room. */
+  ofs = free_slot (dir, name);
+  if (!inode_is_hashed (dir->inode)
+      && ofs >= (off_t) (DIR_HASH_MIN * sizeof e) && dir_hash (dir))
+    ofs = free_slot (dir, name);
+  while (ofs == -1)
+    {
+      if (!dir_split (dir))
+        goto done;
+      ofs = free_slot (dir, name);
+    }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
 
  done:
+  lock_release (&dir_lock);
   return success;
 }
 
@@ -275,6 +672,7 @@ dir_remove (struct dir *dir, const char *name)
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
+  lock_acquire (&dir_lock);
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -301,12 +699,15 @@ dir_remove (struct dir *dir, const char *name)
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
   inode_close (inode);
+  lock_release (&dir_lock);
   return success;
 }
 
@@ -317,24 +718,29 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  rwlock_acquire_read (layout_lock (dir));
+  while (inode_read_at (dir->inode, &e, sizeof e,
+                        dir->pos = next_slot (dir, dir->pos)) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
+          break;
         } 
     }
-  return false;
+  rwlock_release_read (layout_lock (dir));
+  return found;
 }
 
 bool dir_is_empty(struct dir *dir){
   struct dir_entry e;
   size_t ofs;
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
+       ofs = next_slot (dir, ofs + sizeof e)) 
     if (e.in_use)
       return false;
   return true;
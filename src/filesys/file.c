@@ -1,14 +1,22 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <round.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window bounds, in sectors. */
+#define RA_MIN_WINDOW 2
+#define RA_MAX_WINDOW 16
+
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_pos;               /* Where a sequential read would start. */
+    off_t ra_end;               /* End of the data already read ahead. */
+    int ra_window;              /* Read-ahead window in sectors, 0=off. */
   };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -60,6 +68,41 @@ file_get_inode (struct file *file)
   return file->inode;
 }
 
+/* Updates FILE's read-ahead state after a read of BYTES_READ
+   bytes at its current position.  The window doubles on each
+   sequential read and collapses on a seek; sectors inside the
+   window that were not requested before are queued. */
+static void
+file_read_ahead (struct file *file, off_t bytes_read)
+{
+  off_t start, end;
+
+  if (file->pos == file->ra_pos && bytes_read > 0)
+    {
+      file->ra_window = file->ra_window == 0 ? RA_MIN_WINDOW : file->ra_window * 2;
+      if (file->ra_window > RA_MAX_WINDOW)
+        file->ra_window = RA_MAX_WINDOW;
+    }
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  file->ra_pos = file->pos + bytes_read;
+  if (file->ra_window == 0)
+    return;
+
+  start = ROUND_UP (file->ra_pos, DISK_SECTOR_SIZE);
+  end = start + file->ra_window * DISK_SECTOR_SIZE;
+  if (start < file->ra_end)
+    start = file->ra_end;
+  if (start < end)
+    {
+      inode_read_ahead (file->inode, start, (end - start) / DISK_SECTOR_SIZE);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
@@ -69,6 +112,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_read_ahead (file, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -11,6 +11,7 @@
 #include "threads/malloc.h"
 
 struct disk *filesys_disk;
+unsigned block_sectors = 1;
 
 /* The disk that contains the file system. */
 static void do_format (void);
@@ -24,9 +25,16 @@ filesys_init (bool format)
   if (filesys_disk == NULL)
     PANIC ("hd0:1 (hdb) not present, file system initialization failed");
   inode_init ();
-  free_map_init ();
+  dir_init ();
   cache_init ();
 
+  if (!format)
+    {
+      inode_format = inode_format_of (ROOT_DIR_SECTOR);
+      block_sectors = inode_block_sectors_of (FREE_MAP_SECTOR);
+    }
+  free_map_init ();
+  cache_start_flusher ();
   if (format)
     do_format ();
   
@@ -38,8 +46,8 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
-  cache_close ();
   free_map_close ();
+  cache_close ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -60,8 +68,9 @@ filesys_create (const char *name, off_t initial_size)
     return false;
   }
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size, INODE_MAX_LEVEL, false)
+                  && free_map_allocate_near (1, inode_get_inumber (dir_get_inode (dir)),
+                                             &inode_sector)
+                  && inode_create (inode_sector, initial_size, false)
                   && dir_add (dir, filename, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (&inode_sector, 1);
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include "filesys/off_t.h"
+#include "devices/disk.h"
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
@@ -11,6 +12,16 @@
 /* Disk used for file system. */
 extern struct disk *filesys_disk;
 
+/* Most sectors in a file system block. */
+#define BLOCK_SECTORS_MAX 8
+
+/* Sectors per file system block, the unit in which the free map
+   hands out disk space.  A block is identified by its first
+   sector.  Set by -block-size when formatting, otherwise read
+   back from the disk. */
+extern unsigned block_sectors;
+#define FS_BLOCK_SIZE (block_sectors * DISK_SECTOR_SIZE)
+
 void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
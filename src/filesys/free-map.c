@@ -1,61 +1,322 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
+#include <stdint.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
-static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static struct bitmap *free_map;      /* Free map, one bit per block. */
+static struct lock free_map_lock;    /* Protects the free map and its file. */
+
+/* Sectors of the free map file that differ from FREE_MAP, one
+   bit per DISK_SECTOR_SIZE bytes of bitmap, that is, per block
+   group (see below).  Changes reach the disk only when
+   free_map_flush() writes these sectors back. */
+static struct bitmap *free_map_dirty;
+
+/* The disk is divided into block groups of GROUP_BLOCKS blocks,
+   as many as one sector of the free map covers. */
+#define GROUP_BLOCKS (DISK_SECTOR_SIZE * CHAR_BIT)
+static size_t group_cnt;
+static size_t next_block;            /* Goal when the caller has none. */
+
+/* Free runs of a range of blocks. */
+struct run_info
+  {
+    uint32_t prefix;                 /* Free blocks at the start. */
+    uint32_t suffix;                 /* Free blocks at the end. */
+    uint32_t max;                    /* Longest free run inside. */
+  };
+
+/* Index of free space: a complete binary tree over the free map,
+   stored as an array with the root at 1 and the children of node
+   N at 2N and 2N+1.  Each leaf summarizes LEAF_BLOCKS blocks and
+   each inner node the two halves below it, so that a run of free
+   blocks of any length can be found near a goal by walking down
+   from the root, in logarithmic time.  Blocks past the end of the
+   disk count as used. */
+#define LEAF_BLOCKS 32
+static struct run_info *run_tree;
+static size_t leaf_cnt;              /* Number of leaves, a power of 2. */
+
+/* Recomputes leaf LEAF of run_tree from the free map. */
+static void
+run_leaf (size_t leaf)
+{
+  struct run_info *r = &run_tree[leaf_cnt + leaf];
+  size_t start = leaf * LEAF_BLOCKS, i, len = 0;
+
+  r->prefix = r->suffix = r->max = 0;
+  for (i = start; i < start + LEAF_BLOCKS; i++)
+    {
+      if (i < bitmap_size (free_map) && !bitmap_test (free_map, i))
+        len++;
+      else
+        len = 0;
+      if (len == i - start + 1)
+        r->prefix = len;
+      if (len > r->max)
+        r->max = len;
+    }
+  r->suffix = len;
+}
+
+/* Recomputes inner node NODE of run_tree, which spans LEN blocks,
+   from its children. */
+static void
+run_pull (size_t node, size_t len)
+{
+  const struct run_info *l = &run_tree[2 * node], *r = &run_tree[2 * node + 1];
+  struct run_info *n = &run_tree[node];
+  size_t half = len / 2;
+
+  n->prefix = l->prefix == half ? half + r->prefix : l->prefix;
+  n->suffix = r->suffix == half ? half + l->suffix : r->suffix;
+  n->max = l->max > r->max ? l->max : r->max;
+  if (l->suffix + r->prefix > n->max)
+    n->max = l->suffix + r->prefix;
+}
+
+/* Brings run_tree up to date after blocks START...START+CNT-1
+   changed. */
+static void
+run_update (size_t start, size_t cnt)
+{
+  size_t first = start / LEAF_BLOCKS, last = (start + cnt - 1) / LEAF_BLOCKS;
+  size_t len;
+
+  for (; first <= last; first++)
+    run_leaf (first);
+  first = start / LEAF_BLOCKS + leaf_cnt;
+  last += leaf_cnt;
+  for (len = 2 * LEAF_BLOCKS; first > 1; len *= 2)
+    {
+      size_t node;
+      first /= 2;
+      last /= 2;
+      for (node = first; node <= last; node++)
+        run_pull (node, len);
+    }
+}
+
+/* Returns the start of the first run of CNT free blocks that lies
+   wholly within node NODE, which spans the LEN blocks from START,
+   and starts at or after block FROM; or BITMAP_ERROR. */
+static size_t
+run_find (size_t node, size_t start, size_t len, size_t cnt, size_t from)
+{
+  size_t half = len / 2, idx;
+
+  if (start + len <= from || run_tree[node].max < cnt)
+    return BITMAP_ERROR;
+  if (node >= leaf_cnt)
+    {
+      size_t end = start + len < bitmap_size (free_map)
+                   ? start + len : bitmap_size (free_map);
+      for (idx = start > from ? start : from; idx + cnt <= end; idx++)
+        if (bitmap_none (free_map, idx, cnt))
+          return idx;
+      return BITMAP_ERROR;
+    }
+
+  /* Left half, then a run across the middle, then right half. */
+  idx = run_find (2 * node, start, half, cnt, from);
+  if (idx != BITMAP_ERROR)
+    return idx;
+  idx = start + half - run_tree[2 * node].suffix;
+  if (idx < from)
+    idx = from;
+  if (idx < start + half
+      && start + half - idx + run_tree[2 * node + 1].prefix >= cnt)
+    return idx;
+  return run_find (2 * node + 1, start + half, half, cnt, from);
+}
+
+/* Rebuilds run_tree from the free map. */
+static void
+run_build (void)
+{
+  size_t i, len = LEAF_BLOCKS;
+  for (i = 0; i < leaf_cnt; i++)
+    run_leaf (i);
+  for (i = leaf_cnt - 1; i >= 1; i--)
+    {
+      if ((i & (i + 1)) == 0)
+        len *= 2;
+      run_pull (i, len);
+    }
+}
+
+/* Sets blocks START...START+CNT-1 to VALUE in the free map,
+   keeping run_tree and the dirty sectors up to date.  The
+   blocks must all be !VALUE. */
+static void
+free_map_set (size_t start, size_t cnt, bool value)
+{
+  size_t i;
+  ASSERT (value ? bitmap_none (free_map, start, cnt)
+                : bitmap_all (free_map, start, cnt));
+  bitmap_set_multiple (free_map, start, cnt, value);
+  run_update (start, cnt);
+  for (i = start / GROUP_BLOCKS; i <= (start + cnt - 1) / GROUP_BLOCKS; i++)
+    bitmap_mark (free_map_dirty, i);
+}
+
+/* Finds CNT free consecutive blocks, the first such run at or
+   after GOAL if there is one, so that the blocks usually land in
+   GOAL's block group or the next ones.  Returns the first block,
+   or BITMAP_ERROR if there is no such run. */
+static size_t
+free_map_scan_near (size_t cnt, size_t goal)
+{
+  size_t span = leaf_cnt * LEAF_BLOCKS;
+  size_t idx = run_find (1, 0, span, cnt, goal);
+  if (idx == BITMAP_ERROR && goal > 0)
+    idx = run_find (1, 0, span, cnt, 0);
+  return idx;
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (disk_size (filesys_disk));
+  lock_init (&free_map_lock);
+  free_map = bitmap_create (disk_size (filesys_disk) / block_sectors);
   if (free_map == NULL)
     PANIC ("bitmap creation failed--disk is too large");
-  bitmap_mark (free_map, FREE_MAP_SECTOR);
-  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_BLOCKS);
+  free_map_dirty = bitmap_create (group_cnt);
+  for (leaf_cnt = 1; leaf_cnt * LEAF_BLOCKS < bitmap_size (free_map); )
+    leaf_cnt *= 2;
+  run_tree = malloc (2 * leaf_cnt * sizeof *run_tree);
+  if (free_map_dirty == NULL || run_tree == NULL)
+    PANIC ("bitmap creation failed--disk is too large");
+  bitmap_mark (free_map, FREE_MAP_SECTOR / block_sectors);
+  bitmap_mark (free_map, ROOT_DIR_SECTOR / block_sectors);
+  run_build ();
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
-   Returns true if successful, false if all sectors were
+/* Allocates CNT blocks from the free map and stores the first
+   sector of each into SECTORP.
+   Returns true if successful, false if not enough blocks were
    available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) 
 {
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Like free_map_allocate(), but places the blocks as close after
+   sector GOAL as possible, in its block group if there is room.
+   A GOAL of 0 means no preference: allocation then goes on after
+   the last such one, next-fit. */
+bool
+free_map_allocate_near (size_t cnt, disk_sector_t goal, disk_sector_t *sectorp)
+{
+  size_t next;
   int i;
+  lock_acquire (&free_map_lock);
+  next = goal != 0 ? goal / block_sectors : next_block;
   for(i=0;i<cnt;i++){
-    sectorp[i] = bitmap_scan_and_flip (free_map, 0, 1, false);
-    if(sectorp[i] == BITMAP_ERROR){
+    size_t block = free_map_scan_near (1, next);
+    if(block == BITMAP_ERROR){
       for(i=i-1;i>=0;i--)
-        bitmap_set(free_map, sectorp[i], false);
-      if(free_map_file)
-        bitmap_write(free_map, free_map_file);
+        free_map_set (sectorp[i] / block_sectors, 1, false);
+      lock_release (&free_map_lock);
       return false;
     }
+    free_map_set (block, 1, true);
+    sectorp[i] = block * block_sectors;
+    next = block + 1;
   }
-  if (free_map_file != NULL && !bitmap_write (free_map, free_map_file))
-    {
-      for(i=0;i<cnt;i++)
-        bitmap_set (free_map, sectorp[i], false); 
-      return false;
-    }
+  if (goal == 0)
+    next_block = next;
+  lock_release (&free_map_lock);
   return true;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes the CNT blocks whose first sectors are in SECTORP
+   available for use.  Entries of 0 are holes and are skipped. */
 void
 free_map_release (disk_sector_t *sectorp, size_t cnt)
 {
   size_t i;
+  lock_acquire (&free_map_lock);
   for(i=0;i<cnt;i++){
-    ASSERT (bitmap_test (free_map, sectorp[i]));
-    bitmap_set (free_map, sectorp[i], false);
+    if(sectorp[i] == 0)
+      continue;
+    ASSERT (sectorp[i] % block_sectors == 0);
+    free_map_set (sectorp[i] / block_sectors, 1, false);
   }
-  bitmap_write (free_map, free_map_file);
+  lock_release (&free_map_lock);
+}
+
+/* Allocates a run of up to CNT consecutive blocks and stores
+   its first sector into *SECTORP, preferring a run that starts
+   at sector HINT, and failing that one in HINT's block group.  If
+   there is no run of CNT blocks, settles for a shorter one.
+   Returns the number of blocks allocated, 0 if none are free. */
+size_t
+free_map_allocate_run (size_t cnt, disk_sector_t hint, disk_sector_t *sectorp)
+{
+  size_t start, len = 0;
+
+  lock_acquire (&free_map_lock);
+  hint /= block_sectors;
+
+  /* Extend the run that ends just before HINT in place. */
+  while (len < cnt && hint + len < bitmap_size (free_map)
+         && !bitmap_test (free_map, hint + len))
+    len++;
+  if (len > 0)
+    start = hint;
+  else
+    {
+      /* The root knows the longest free run on the disk. */
+      len = cnt < run_tree[1].max ? cnt : run_tree[1].max;
+      if (len > 0)
+        start = free_map_scan_near (len, hint);
+    }
+  if (len > 0)
+    {
+      free_map_set (start, len, true);
+      *sectorp = start * block_sectors;
+    }
+  lock_release (&free_map_lock);
+  return len;
+}
+
+/* Makes the CNT blocks starting at SECTOR available for use. */
+void
+free_map_release_run (disk_sector_t sector, size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (sector % block_sectors == 0);
+  free_map_set (sector / block_sectors, cnt, false);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the changed sectors of the free map to its file.  Does
+   nothing before the file is open. */
+void
+free_map_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (i = 0; i < bitmap_size (free_map_dirty); i++)
+      if (bitmap_test (free_map_dirty, i)
+          && bitmap_write_part (free_map, free_map_file,
+                                i * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE))
+        bitmap_reset (free_map_dirty, i);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -67,13 +328,21 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  run_build ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
-  file_close (free_map_file);
+  struct file *file;
+
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
+  file = free_map_file;
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -82,13 +351,19 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), INODE_MAX_LEVEL, false))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The file starts out as a hole, so the
+     first write allocates its sectors; only then can free map
+     updates be written through it. */
+  struct file *file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  free_map_file = file;
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
 }
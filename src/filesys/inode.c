@@ -1,11 +1,14 @@
 #include "filesys/inode.h"
 #include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "filesys/cache.h"
 
 /* Identifies an inode. */
@@ -15,6 +18,24 @@
 #define SINGLE_INDIRECT_INODE 100
 #define DOUBLE_INDIRECT_INODE 2
 
+/* A run of LENGTH consecutive data blocks starting at sector
+   START. */
+struct extent
+  {
+    disk_sector_t start;
+    uint32_t length;
+  };
+
+/* Largest file kept inline, in the inode sector itself. */
+#define INLINE_MAX (DIRECT_INODE * sizeof (disk_sector_t))
+
+/* Number of extents in an extent-format inode. */
+#define EXTENT_CNT (DIRECT_INODE * sizeof (disk_sector_t) / sizeof (struct extent))
+
+/* Format of inodes created from now on.  do_format() takes it
+   from the -inode-format option; a mounted file system keeps the
+   format of its root directory. */
+enum inode_format inode_format = INODE_INDEXED;
 
 /* On-disk inode.
    Must be exactly DISK_SECTOR_SIZE bytes long. */
@@ -22,76 +43,487 @@ struct inode_disk
   {
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t count;                     /* number of inode */
-    uint32_t level;                     /* level of inode */
-    disk_sector_t inode_index[100];     /* sector number of inode */
-    disk_sector_t parent_sector;        /* Sector number of parent (only level 2)*/
+    uint32_t count;                     /* number of inode, or of extents */
+    uint32_t level;                     /* levels of index below this block */
+    union
+      {
+        disk_sector_t inode_index[100]; /* sector number of inode */
+        struct extent extents[EXTENT_CNT]; /* data runs (INODE_EXTENT) */
+        uint8_t inline_data[INLINE_MAX]; /* file data (IS_INLINE) */
+      };
+    disk_sector_t parent_sector;        /* Sector number of parent (top block only) */
     uint32_t is_dir;                    /* check inode is directory */
-    uint32_t unused[22];               /* Not used. */
+    uint32_t format;                    /* enum inode_format (top block only) */
+    uint32_t is_inline;                 /* data in INLINE_DATA (top block only) */
+    uint32_t block_sectors;             /* sectors per block (top block only) */
+    uint32_t buckets;                   /* hashed directory's buckets, 0 if plain */
+    uint32_t spilled;                   /* INODE_EXTENT moved to indexed (top block only) */
+    uint32_t unused[17];               /* Not used. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
+/* Returns true if DISK_INODE maps its data with extents.  An
+   extent-format inode that runs out of extents is moved to the
+   indexed layout, but keeps its FORMAT. */
+static inline bool
+is_extent (const struct inode_disk *disk_inode)
+{
+  return disk_inode->format == INODE_EXTENT && !disk_inode->spilled;
+}
+
+/* Returns the number of blocks to allocate for an inode SIZE
    bytes long. */
 static inline size_t
-bytes_to_sectors (off_t size)
+bytes_to_blocks (off_t size)
 {
-  return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
+  return DIV_ROUND_UP (size, FS_BLOCK_SIZE);
 }
 
+/* Number of leaf index blocks kept decoded per open inode. */
+#define INDEX_CACHE_SIZE 4
+
+/* A leaf index block copied out of the buffer cache: the data
+   blocks of file blocks LEAF * DIRECT_INODE and up. */
+struct index_block
+  {
+    int leaf;                           /* Leaf number, or -1 if empty. */
+    disk_sector_t map[DIRECT_INODE];    /* Data blocks. */
+  };
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in inode_table. */
+    struct list_elem elem;              /* Element in closed_inodes. */
     disk_sector_t sector;               /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    bool loading;                       /* DATA being read by the first opener. */
+    struct rwlock rw;                   /* Readers share, writers exclude. */
+    struct lock index_lock;             /* Protects INDEX. */
+    struct index_block *index;          /* INDEX_CACHE_SIZE decoded leaves, or NULL. */
     struct inode_disk data;             /* Inode content. */
   };
 
-/* Returns the disk sector that contains byte offset POS within
-   INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+/* Returns entry IDX of the index block in SECTOR, read in place
+   from the buffer cache. */
+static disk_sector_t
+index_at (disk_sector_t sector, size_t idx)
+{
+  struct cache_entry *c = cache_get (sector);
+  disk_sector_t child = ((struct inode_disk *) cache_data (c))->inode_index[idx];
+  cache_put (c, false);
+  return child;
+}
+
+/* Returns the data block for block IDX of extent-format
+   DISK_INODE, 0 if it is a hole, or -1 if it has no such
+   block. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+extent_to_block (const struct inode_disk *disk_inode, size_t idx)
+{
+  size_t i;
+  for (i = 0; i < disk_inode->count; i++)
+    {
+      if (idx < disk_inode->extents[i].length)
+        return disk_inode->extents[i].start != 0
+               ? disk_inode->extents[i].start + idx * block_sectors : 0;
+      idx -= disk_inode->extents[i].length;
+    }
+  return -1;
+}
+
+/* Returns the number of data blocks of extent-format DISK_INODE. */
+static size_t
+extent_blocks (const struct inode_disk *disk_inode)
+{
+  size_t i, blocks = 0;
+  for (i = 0; i < disk_inode->count; i++)
+    blocks += disk_inode->extents[i].length;
+  return blocks;
+}
+
+/* Releases the data blocks of extent-format DISK_INODE past its
+   first BLOCKS. */
+static void
+extent_truncate (struct inode_disk *disk_inode, size_t blocks)
+{
+  while (disk_inode->count > 0)
+    {
+      struct extent *e = &disk_inode->extents[disk_inode->count - 1];
+      size_t keep = extent_blocks (disk_inode) - e->length;
+      if (keep >= blocks)
+        {
+          if (e->start != 0)
+            free_map_release_run (e->start, e->length);
+          disk_inode->count--;
+        }
+      else
+        {
+          if (keep + e->length > blocks && e->start != 0)
+            {
+              free_map_release_run (e->start + (blocks - keep) * block_sectors,
+                                    keep + e->length - blocks);
+              e->length = blocks - keep;
+            }
+          else if (keep + e->length > blocks)
+            e->length = blocks - keep;
+          break;
+        }
+    }
+}
+
+/* Grows extent-format DISK_INODE to BLOCKS data blocks.  The
+   new blocks form a hole, an extent that starts at sector 0, and
+   get disk space only when written. */
+static bool
+extent_growth (struct inode_disk *disk_inode, size_t blocks)
+{
+  size_t have = extent_blocks (disk_inode);
+  struct extent *last;
+
+  if (have >= blocks)
+    return true;
+  last = disk_inode->count > 0 ? &disk_inode->extents[disk_inode->count - 1] : NULL;
+  if (last == NULL || last->start != 0)
+    {
+      if (disk_inode->count == EXTENT_CNT)
+        return false;
+      last = &disk_inode->extents[disk_inode->count++];
+      last->start = 0;
+      last->length = 0;
+    }
+  last->length += blocks - have;
+  return true;
+}
+
+/* Allocates a run of up to WANT data blocks for extent-format
+   DISK_INODE, starting at block IDX, which must be a hole, and
+   ending no later than the hole.  Returns the first block and
+   stores the number allocated into *CNTP, or returns 0 on
+   failure.  The run is taken right after the preceding extent if
+   possible, so that filling a hole in order grows that extent
+   instead of splitting the hole, and otherwise near sector GOAL. */
+static disk_sector_t
+extent_fill (struct inode_disk *disk_inode, size_t idx, size_t want,
+             disk_sector_t goal, size_t *cntp)
+{
+  struct extent *e, *prev, piece[3];
+  disk_sector_t sector, hint = 0;
+  size_t i, len, cnt = 0;
+
+  for (i = 0; idx >= disk_inode->extents[i].length; i++)
+    idx -= disk_inode->extents[i].length;
+  e = &disk_inode->extents[i];
+  prev = i > 0 ? &disk_inode->extents[i - 1] : NULL;
+  ASSERT (e->start == 0);
+
+  if (want > e->length - idx)
+    want = e->length - idx;
+  if (idx == 0 && prev != NULL && prev->start != 0)
+    hint = prev->start + prev->length * block_sectors;
+  len = free_map_allocate_run (want, hint != 0 ? hint : goal, &sector);
+  if (len == 0)
+    return 0;
+  *cntp = len;
+
+  if (hint != 0 && sector == hint)
+    {
+      /* Grow the preceding extent into the hole. */
+      prev->length += len;
+      e->length -= len;
+      if (e->length > 0)
+        return sector;
+    }
+  else
+    {
+      /* Split the hole around the new run. */
+      if (idx > 0)
+        piece[cnt++] = (struct extent) {0, idx};
+      piece[cnt++] = (struct extent) {sector, len};
+      if (idx + len < e->length)
+        piece[cnt++] = (struct extent) {0, e->length - idx - len};
+      if (disk_inode->count + cnt - 1 > EXTENT_CNT)
+        {
+          free_map_release_run (sector, len);
+          return 0;
+        }
+      memmove (e + cnt, e + 1, (disk_inode->count - i - 1) * sizeof *e);
+      memcpy (e, piece, cnt * sizeof *e);
+      disk_inode->count += cnt - 1;
+      return sector;
+    }
+
+  /* The hole is gone. */
+  memmove (e, e + 1, (disk_inode->count - i - 1) * sizeof *e);
+  disk_inode->count--;
+  return sector;
+}
+
+/* Returns the number of data blocks an index tree LEVEL levels
+   deep can map. */
+static size_t
+index_capacity (int level)
+{
+  size_t cnt = DIRECT_INODE;
+  for (; level > 0; level--)
+    cnt *= SINGLE_INDIRECT_INODE;
+  return cnt;
+}
+
+/* Returns the sector of leaf index block LEAF of INODE, whose
+   tree is at least one level deep. */
+static disk_sector_t
+leaf_sector (const struct inode *inode, size_t leaf)
+{
+  ASSERT (inode->data.level > 0);
+  if (inode->data.level == 1)
+    return inode->data.inode_index[leaf];
+  return index_at (inode->data.inode_index[leaf / SINGLE_INDIRECT_INODE],
+                   leaf % SINGLE_INDIRECT_INODE);
+}
+
+/* Forgets the decoded index blocks of INODE.  Must be called
+   whenever its index tree changes. */
+static void
+index_invalidate (struct inode *inode)
+{
+  int i;
+  if (inode->index != NULL)
+    for (i = 0; i < INDEX_CACHE_SIZE; i++)
+      inode->index[i].leaf = -1;
+}
+
+/* Returns the decoded leaf index block number LEAF of INODE,
+   reading it through the buffer cache on a miss, or a null
+   pointer if memory is short. */
+static struct index_block *
+index_lookup (struct inode *inode, int leaf)
+{
+  struct index_block *b;
+  if (inode->index == NULL)
+    {
+      inode->index = malloc (INDEX_CACHE_SIZE * sizeof *inode->index);
+      if (inode->index == NULL)
+        return NULL;
+      index_invalidate (inode);
+    }
+  b = &inode->index[leaf % INDEX_CACHE_SIZE];
+  if (b->leaf != leaf)
+    {
+      cache_read (leaf_sector (inode, leaf), b->map, offsetof (struct inode_disk, inode_index),
+                  sizeof b->map);
+      b->leaf = leaf;
+    }
+  return b;
+}
+
+/* Allocates a data block for block IDX of INODE's indexed tree
+   if it is a hole, and returns the block, or 0 on failure.  The
+   block goes right after the file's preceding block if that one
+   is in the same index block, otherwise near the index block. */
+static disk_sector_t
+index_fill (struct inode *inode, size_t idx)
+{
+  if (inode->data.level == 0)
+    {
+      /* Direct: the entry is in the inode itself. */
+      disk_sector_t new_sector;
+      disk_sector_t goal = idx > 0 && inode->data.inode_index[idx - 1] != 0
+                           ? inode->data.inode_index[idx - 1] : inode->sector;
+      if (inode->data.inode_index[idx] == 0
+          && free_map_allocate_near (1, goal, &new_sector))
+        {
+          inode->data.inode_index[idx] = new_sector;
+          cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+        }
+      return inode->data.inode_index[idx];
+    }
+
+  disk_sector_t leaf = leaf_sector (inode, idx / DIRECT_INODE);
+  struct cache_entry *c = cache_get (leaf);
+  disk_sector_t *entry = &((struct inode_disk *) cache_data (c))->inode_index[idx % DIRECT_INODE];
+  disk_sector_t sector = *entry, new_sector;
+  disk_sector_t goal = idx % DIRECT_INODE > 0 && entry[-1] != 0 ? entry[-1] : leaf;
+  bool dirty = false;
+
+  if (sector == 0 && free_map_allocate_near (1, goal, &new_sector))
+    {
+      *entry = sector = new_sector;
+      dirty = true;
+    }
+  cache_put (c, dirty);
+
+  lock_acquire (&inode->index_lock);
+  if (sector != 0 && inode->index != NULL
+      && inode->index[idx / DIRECT_INODE % INDEX_CACHE_SIZE].leaf == (int) (idx / DIRECT_INODE))
+    inode->index[idx / DIRECT_INODE % INDEX_CACHE_SIZE].map[idx % DIRECT_INODE] = sector;
+  lock_release (&inode->index_lock);
+  return sector;
+}
+
+static bool extent_spill (struct inode *inode);
+
+/* Gives the block of INODE at byte OFFSET, a hole, its own data
+   block for a write of SIZE bytes there, and returns it, or 0 if
+   the disk is full.  An extent-format INODE gets as many
+   consecutive blocks at once as the write covers and the hole
+   reaches, so that a large write fills it with one run.  Only the
+   sectors the write does not wholly overwrite are zeroed. */
+static disk_sector_t
+inode_fill (struct inode *inode, off_t offset, off_t size)
+{
+  static char zeros[DISK_SECTOR_SIZE];
+  size_t idx = offset / FS_BLOCK_SIZE, cnt = 1;
+  size_t want = DIV_ROUND_UP (offset % FS_BLOCK_SIZE + size, FS_BLOCK_SIZE);
+  disk_sector_t sector;
+  unsigned i;
+
+  if (is_extent (&inode->data) && inode->data.count + 2 > EXTENT_CNT)
+    extent_spill (inode);
+  if (is_extent (&inode->data))
+    {
+      sector = extent_fill (&inode->data, idx, want, inode->sector, &cnt);
+      if (sector != 0)
+        cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+    }
+  else
+    sector = index_fill (inode, idx);
+  if (sector != 0)
+    for (i = 0; i < cnt * block_sectors; i++)
+      {
+        off_t ofs = (off_t) idx * FS_BLOCK_SIZE + i * DISK_SECTOR_SIZE;
+        if (ofs < offset || ofs + DISK_SECTOR_SIZE > offset + size)
+          cache_write (sector + i, zeros, 0, DISK_SECTOR_SIZE);
+      }
+  return sector;
+}
+
+/* Returns the first sector of the block that contains byte
+   offset POS within INODE, or 0 if that block is a hole that
+   reads as zeros.  Returns -1 if INODE does not contain data for
+   a byte at offset POS. */
+static disk_sector_t
+byte_to_block (struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length){
-    pos /= DISK_SECTOR_SIZE;
-    struct inode_disk *disk_inode = calloc(1, sizeof(struct inode_disk));
-    if(disk_inode == NULL) return -1;
-    disk_sector_t sector;
-    cache_read(inode->data.inode_index[pos/(DIRECT_INODE*SINGLE_INDIRECT_INODE)], disk_inode, 0, DISK_SECTOR_SIZE);
-    pos%=DIRECT_INODE*SINGLE_INDIRECT_INODE;
-    sector = disk_inode->inode_index[pos/SINGLE_INDIRECT_INODE];
-    cache_read(sector, disk_inode, 0, DISK_SECTOR_SIZE);
-    sector = disk_inode->inode_index[pos%SINGLE_INDIRECT_INODE];
-    free(disk_inode);
-    return sector;
+    struct index_block *b;
+    pos /= FS_BLOCK_SIZE;
+    if (is_extent (&inode->data))
+      return extent_to_block (&inode->data, pos);
+    if (inode->data.level == 0)
+      return inode->data.inode_index[pos];
+    lock_acquire (&inode->index_lock);
+    b = index_lookup (inode, pos / DIRECT_INODE);
+    if (b != NULL)
+      {
+        disk_sector_t sector = b->map[pos % DIRECT_INODE];
+        lock_release (&inode->index_lock);
+        return sector;
+      }
+    lock_release (&inode->index_lock);
+    return index_at (leaf_sector (inode, pos / DIRECT_INODE), pos % DIRECT_INODE);
   }
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns the disk sector that contains byte offset POS within
+   INODE, or 0 if it lies in a hole, or -1 if INODE does not
+   contain data for a byte at offset POS. */
+static disk_sector_t
+byte_to_sector (struct inode *inode, off_t pos)
+{
+  disk_sector_t block = byte_to_block (inode, pos);
+  if (block == 0 || block == (disk_sector_t) -1)
+    return block;
+  return block + pos % FS_BLOCK_SIZE / DISK_SECTOR_SIZE;
+}
+
+/* Open inodes by sector, so that opening a single inode twice
+   returns the same `struct inode'.  An inode closed by its last
+   opener stays in the table, unchanged, on the closed_inodes LRU
+   list until it is reopened or pushed out by more recently
+   closed ones.  inode_table_lock protects both, along with the
+   open, loading and removed state of every inode, but is never
+   held across disk I/O: inode_loaded is signalled when an inode
+   stops loading. */
+static struct lock inode_table_lock;
+static struct condition inode_loaded;
+static struct hash inode_table;
+static struct list closed_inodes;
+static size_t closed_cnt;
+
+/* Most closed inodes kept in memory. */
+#define CLOSED_INODE_MAX 32
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, hash_elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return hash_entry (a, struct inode, hash_elem)->sector
+         < hash_entry (b, struct inode, hash_elem)->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&inode_table, inode_hash, inode_less, NULL))
+    PANIC ("inode table creation failed");
+  lock_init (&inode_table_lock);
+  cond_init (&inode_loaded);
+  list_init (&closed_inodes);
 }
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   disk.
-   Returns true if successful.
-   Returns false if memory or disk allocation fails. */
-bool
-inode_create (disk_sector_t sector, off_t length, int level, bool is_dir)
+/* Removes INODE, which has no openers, from the inode table and
+   frees it. */
+static void
+inode_free (struct inode *inode)
+{
+  hash_delete (&inode_table, &inode->hash_elem);
+  free (inode->index);
+  free (inode);
+}
+
+/* Drops the closed inode kept in memory for SECTOR, if any.  A
+   sector freed without going through a removed inode, such as a
+   directory whose dir_add() failed, may still have one, and it
+   must not be found again once the sector holds a new inode. */
+static void
+inode_forget (disk_sector_t sector)
+{
+  static struct inode key;      /* Too big for the stack; under inode_table_lock. */
+  struct hash_elem *e;
+  struct inode *inode;
+
+  lock_acquire (&inode_table_lock);
+  key.sector = sector;
+  e = hash_find (&inode_table, &key.hash_elem);
+  if (e != NULL)
+    {
+      inode = hash_entry (e, struct inode, hash_elem);
+      ASSERT (inode->open_cnt == 0);
+      list_remove (&inode->elem);
+      closed_cnt--;
+      inode_free (inode);
+    }
+  lock_release (&inode_table_lock);
+}
+
+static void index_delete (disk_sector_t sector);
+
+/* Writes an index block LEVEL levels deep to SECTOR, mapping
+   LENGTH bytes of holes.  Returns true if successful. */
+static bool
+index_create (disk_sector_t sector, off_t length, int level, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -105,36 +537,29 @@ inode_create (disk_sector_t sector, off_t length, int level, bool is_dir)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
   {
-    size_t sectors = bytes_to_sectors (length);
+    size_t blocks = bytes_to_blocks (length);
     disk_inode->length = length;
     disk_inode->magic = INODE_MAGIC;
     disk_inode->level = level;
     disk_inode->is_dir = is_dir;
-    if(level == 0){ // direct
-      disk_inode->count = sectors;
-      if (free_map_allocate (sectors, disk_inode->inode_index)){
-        cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
-        static char zeros[DISK_SECTOR_SIZE];
-        size_t i;
-
-        for (i = 0; i < disk_inode->count; i++) 
-          cache_write (disk_inode->inode_index[i], zeros, 0, DISK_SECTOR_SIZE); 
-        success = true; 
-      } 
+    if(level == 0){ // direct, data blocks left as holes
+      disk_inode->count = blocks;
+      cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
+      success = true;
     }
     else if(level == 1){ // sigle indirect
-      disk_inode->count = DIV_ROUND_UP(sectors, DIRECT_INODE);
-      if(free_map_allocate (disk_inode->count, disk_inode->inode_index)){
+      disk_inode->count = DIV_ROUND_UP(blocks, DIRECT_INODE);
+      if(free_map_allocate_near (disk_inode->count, sector, disk_inode->inode_index)){
         size_t size;
         int i;
         for (i = 0; i < disk_inode->count; i++){
-          size = sectors - DIRECT_INODE*i;
+          size = blocks - DIRECT_INODE*i;
           if(size > DIRECT_INODE)
             size = DIRECT_INODE;
-          if(!inode_create(disk_inode->inode_index[i], size*DISK_SECTOR_SIZE, level-1, is_dir)){
+          if(!index_create(disk_inode->inode_index[i], size*FS_BLOCK_SIZE, level-1, is_dir)){
             success = false;
             for(i=i-1;i>=0;i--)
-              inode_delete(disk_inode->inode_index[i]);
+              index_delete(disk_inode->inode_index[i]);
             break;
           }
         }
@@ -145,18 +570,18 @@ inode_create (disk_sector_t sector, off_t length, int level, bool is_dir)
       }
     }
     else{ // double indirect
-      disk_inode->count = DIV_ROUND_UP(sectors, DIRECT_INODE * SINGLE_INDIRECT_INODE);
-      if(free_map_allocate (disk_inode->count, disk_inode->inode_index)){
+      disk_inode->count = DIV_ROUND_UP(blocks, DIRECT_INODE * SINGLE_INDIRECT_INODE);
+      if(free_map_allocate_near (disk_inode->count, sector, disk_inode->inode_index)){
         size_t size;
         int i;
         for (i = 0; i < disk_inode->count; i++){
-          size = sectors-DIRECT_INODE*SINGLE_INDIRECT_INODE*i;
+          size = blocks-DIRECT_INODE*SINGLE_INDIRECT_INODE*i;
           if(size > SINGLE_INDIRECT_INODE * DIRECT_INODE)
             size = SINGLE_INDIRECT_INODE * DIRECT_INODE;
-          if(!inode_create(disk_inode->inode_index[i], size*DISK_SECTOR_SIZE, level-1, is_dir)){
+          if(!index_create(disk_inode->inode_index[i], size*FS_BLOCK_SIZE, level-1, is_dir)){
             success = false;
             for(i=i-1;i>=0;i--)
-              inode_delete(disk_inode->inode_index[i]);
+              index_delete(disk_inode->inode_index[i]);
             break;
           }
         }
@@ -172,25 +597,106 @@ inode_create (disk_sector_t sector, off_t length, int level, bool is_dir)
   return success;
 }
 
-void inode_delete(disk_sector_t sector){
+/* Initializes an inode with LENGTH bytes of data and
+   writes the new inode to sector SECTOR on the file system
+   disk.
+   Returns true if successful.
+   Returns false if memory or disk allocation fails. */
+bool
+inode_create (disk_sector_t sector, off_t length, bool is_dir)
+{
   struct inode_disk *disk_inode;
+  bool success;
+
+  ASSERT (length >= 0);
+  inode_forget (sector);
+  if (length > (off_t) INLINE_MAX && inode_format == INODE_INDEXED)
+    {
+      /* Start with the shallowest tree that maps LENGTH bytes.
+         index_create() writes every index block the same way, so
+         the top one gets the layout parameters afterwards; the
+         free map inode's BLOCK_SECTORS is read back at mount. */
+      struct cache_entry *c;
+      int level = 0;
+      while (level < INODE_MAX_LEVEL
+             && bytes_to_blocks (length) > index_capacity (level))
+        level++;
+      if (!index_create (sector, length, level, is_dir))
+        return false;
+      c = cache_get (sector);
+      disk_inode = cache_data (c);
+      disk_inode->format = inode_format;
+      disk_inode->block_sectors = block_sectors;
+      cache_put (c, true);
+      return true;
+    }
+
   disk_inode = calloc (1, sizeof *disk_inode);
-  if(disk_inode != NULL){
-    cache_read(sector, disk_inode, 0, DISK_SECTOR_SIZE);
-    if(disk_inode->level == 0)
-      free_map_release(disk_inode->inode_index, disk_inode->count);
-    else{
-      size_t i;
-      for(i=0;i<disk_inode->count;i++)
-        inode_delete(disk_inode->inode_index[i]);
-    }
-    free(disk_inode);
-  }
+  if (disk_inode == NULL)
+    return false;
+  disk_inode->length = length;
+  disk_inode->magic = INODE_MAGIC;
+  disk_inode->is_dir = is_dir;
+  disk_inode->format = inode_format;
+  disk_inode->block_sectors = block_sectors;
+  if (length <= (off_t) INLINE_MAX)
+    {
+      /* Small enough to live in the inode sector.  FORMAT is the
+         layout it takes once it outgrows it. */
+      disk_inode->is_inline = true;
+      success = true;
+    }
+  else
+    success = extent_growth (disk_inode, bytes_to_blocks (length));
+  if (success)
+    cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
+  free (disk_inode);
+  return success;
+}
+
+/* Frees the blocks that index block DISK_INODE maps, data and
+   index blocks alike, but not DISK_INODE's own block. */
+static void
+index_release (struct inode_disk *disk_inode)
+{
+  size_t i;
+  if(disk_inode->level == 0)
+    free_map_release(disk_inode->inode_index, disk_inode->count);
+  else
+    for(i=0;i<disk_inode->count;i++)
+      if(disk_inode->inode_index[i] != 0)
+        index_delete(disk_inode->inode_index[i]);
+}
+
+/* Frees index block SECTOR and everything below it. */
+static void
+index_delete (disk_sector_t sector)
+{
+  struct cache_entry *c = cache_get(sector);
+  index_release(cache_data(c));
+  cache_put(c, false);
   free_map_release(&sector, 1);
 }
 
-bool
-inode_growth (struct inode_disk *disk_inode, disk_sector_t sector, off_t length, int level, bool is_dir)
+/* Frees the inode in SECTOR and all of its data. */
+void inode_delete(disk_sector_t sector){
+  struct cache_entry *c = cache_get(sector);
+  struct inode_disk *disk_inode = cache_data(c);
+  if(disk_inode->is_inline)
+    ;
+  else if(is_extent(disk_inode))
+    extent_truncate(disk_inode, 0);
+  else
+    index_release(disk_inode);
+  cache_put(c, false);
+  free_map_release(&sector, 1);
+}
+
+/* Grows the index tree rooted at DISK_INODE to LENGTH bytes,
+   leaving the new data blocks as holes.  DISK_INODE itself is
+   updated in memory only; the caller writes it back. */
+static bool
+inode_growth (struct inode_disk *disk_inode, off_t length, int level, bool is_dir)
 {
   bool success = true;
 
@@ -200,45 +706,35 @@ inode_growth (struct inode_disk *disk_inode, disk_sector_t sector, off_t length,
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
 
-  size_t sectors = bytes_to_sectors (length);
+  size_t blocks = bytes_to_blocks (length);
   disk_inode->length = length;
   disk_inode->level = level;
   disk_inode->is_dir = is_dir;
   size_t old_count = disk_inode->count;
-  if(level == 0){ // direct
-    disk_inode->count = sectors;
-    if (free_map_allocate (disk_inode->count - old_count, disk_inode->inode_index + old_count)){
-      static char zeros[DISK_SECTOR_SIZE];
-      size_t i;
-
-      cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
-      for (i = old_count; i < disk_inode->count; i++) 
-        cache_write (disk_inode->inode_index[i], zeros, 0, DISK_SECTOR_SIZE); 
-    } 
-    else
-      success = false;
+  if(level == 0){ // direct, data blocks left as holes
+    disk_inode->count = blocks;
+    memset (disk_inode->inode_index + old_count, 0,
+            (blocks - old_count) * sizeof *disk_inode->inode_index);
   }
   else if(level == 1){ // sigle indirect
-    disk_inode->count = DIV_ROUND_UP(sectors, DIRECT_INODE);
-    size_t size = sectors-DIRECT_INODE*(old_count-1);
+    disk_inode->count = DIV_ROUND_UP(blocks, DIRECT_INODE);
+    size_t size = blocks-DIRECT_INODE*(old_count-1);
     if(size > DIRECT_INODE)
       size = DIRECT_INODE;    
     if(old_count!=0){
-      struct inode_disk *new_disk_inode = calloc(1, sizeof(struct inode_disk));
-      if(new_disk_inode == NULL)
-        return false;
-      cache_read(disk_inode->inode_index[old_count-1], new_disk_inode, 0, DISK_SECTOR_SIZE);
-      success &= inode_growth(new_disk_inode, disk_inode->inode_index[old_count-1], size*DISK_SECTOR_SIZE, level-1, is_dir);
-      free(new_disk_inode);
+      struct cache_entry *c = cache_get(disk_inode->inode_index[old_count-1]);
+      success &= inode_growth(cache_data(c), size*FS_BLOCK_SIZE, level-1, is_dir);
+      cache_put(c, true);
     }
-    if (success && free_map_allocate (disk_inode->count - old_count, disk_inode->inode_index + old_count)){
-      cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
+    if (success && free_map_allocate_near (disk_inode->count - old_count,
+                                           old_count != 0 ? disk_inode->inode_index[old_count - 1] : 0,
+                                           disk_inode->inode_index + old_count)){
       int i;
       for (i = old_count; i < disk_inode->count; i++){
-        size = sectors - DIRECT_INODE*i;
+        size = blocks - DIRECT_INODE*i;
         if(size > DIRECT_INODE)
           size = DIRECT_INODE;
-        if(!inode_create(disk_inode->inode_index[i], size*DISK_SECTOR_SIZE, level-1, is_dir))
+        if(!index_create(disk_inode->inode_index[i], size*FS_BLOCK_SIZE, level-1, is_dir))
           return false;
       }
     }
@@ -246,26 +742,24 @@ inode_growth (struct inode_disk *disk_inode, disk_sector_t sector, off_t length,
       success = false;
   }
   else{ // double indirect
-    disk_inode->count = DIV_ROUND_UP(sectors, DIRECT_INODE * SINGLE_INDIRECT_INODE);
-    size_t size = sectors-DIRECT_INODE*SINGLE_INDIRECT_INODE*(old_count-1);
+    disk_inode->count = DIV_ROUND_UP(blocks, DIRECT_INODE * SINGLE_INDIRECT_INODE);
+    size_t size = blocks-DIRECT_INODE*SINGLE_INDIRECT_INODE*(old_count-1);
     if(size > SINGLE_INDIRECT_INODE * DIRECT_INODE)
       size = SINGLE_INDIRECT_INODE * DIRECT_INODE;
     if(old_count!=0){
-      struct inode_disk *new_disk_inode = calloc(1, sizeof(struct inode_disk));
-      if(new_disk_inode == NULL)
-        return false;
-      cache_read(disk_inode->inode_index[old_count-1], new_disk_inode, 0, DISK_SECTOR_SIZE);
-      success &= inode_growth(new_disk_inode, disk_inode->inode_index[old_count-1], size*DISK_SECTOR_SIZE, level-1, is_dir);
-      free(new_disk_inode);
+      struct cache_entry *c = cache_get(disk_inode->inode_index[old_count-1]);
+      success &= inode_growth(cache_data(c), size*FS_BLOCK_SIZE, level-1, is_dir);
+      cache_put(c, true);
     }
-    if (success && free_map_allocate (disk_inode->count - old_count, disk_inode->inode_index + old_count)){
-      cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
+    if (success && free_map_allocate_near (disk_inode->count - old_count,
+                                           old_count != 0 ? disk_inode->inode_index[old_count - 1] : 0,
+                                           disk_inode->inode_index + old_count)){
       int i;
       for (i = old_count; i < disk_inode->count; i++){
-        size = sectors-DIRECT_INODE*SINGLE_INDIRECT_INODE*i;
+        size = blocks-DIRECT_INODE*SINGLE_INDIRECT_INODE*i;
         if(size > SINGLE_INDIRECT_INODE * DIRECT_INODE)
           size = SINGLE_INDIRECT_INODE * DIRECT_INODE;
-        if(!inode_create(disk_inode->inode_index[i], size*DISK_SECTOR_SIZE, level-1, is_dir))
+        if(!index_create(disk_inode->inode_index[i], size*FS_BLOCK_SIZE, level-1, is_dir))
           return false;
       }
     }
@@ -274,38 +768,139 @@ inode_growth (struct inode_disk *disk_inode, disk_sector_t sector, off_t length,
   }
   return success;
 }
+
+/* Grows the index tree of top-level DISK_INODE to LENGTH bytes,
+   first adding levels on top while the tree is too shallow: the
+   old top block moves to a new sector that becomes the first
+   child of the next level up. */
+static bool
+index_growth (struct inode_disk *disk_inode, off_t length)
+{
+  while (disk_inode->level < INODE_MAX_LEVEL
+         && bytes_to_blocks (length) > index_capacity (disk_inode->level))
+    {
+      if (disk_inode->count > 0)
+        {
+          disk_sector_t child;
+          if (!free_map_allocate_near (1, disk_inode->inode_index[0], &child))
+            return false;
+          cache_write (child, disk_inode, 0, DISK_SECTOR_SIZE);
+          memset (disk_inode->inode_index, 0, sizeof disk_inode->inode_index);
+          disk_inode->inode_index[0] = child;
+          disk_inode->count = 1;
+        }
+      disk_inode->level++;
+    }
+  return inode_growth (disk_inode, length, disk_inode->level, disk_inode->is_dir);
+}
+
+/* Maps block IDX of INODE's indexed tree, a hole, to the data
+   block in SECTOR. */
+static void
+index_set (struct inode *inode, size_t idx, disk_sector_t sector)
+{
+  struct cache_entry *c;
+  if (inode->data.level == 0)
+    {
+      inode->data.inode_index[idx] = sector;
+      return;
+    }
+  c = cache_get (leaf_sector (inode, idx / DIRECT_INODE));
+  ((struct inode_disk *) cache_data (c))->inode_index[idx % DIRECT_INODE] = sector;
+  cache_put (c, true);
+}
+
+/* Moves extent-format INODE, which is out of extents, to the
+   indexed layout, leaving its data blocks where they are.
+   Returns false if memory or disk space for the index blocks
+   runs out, leaving INODE unchanged. */
+static bool
+extent_spill (struct inode *inode)
+{
+  struct inode_disk *old = malloc (sizeof *old);
+  size_t i, j, idx = 0;
+
+  if (old == NULL)
+    return false;
+  *old = inode->data;
+  memset (inode->data.inode_index, 0, sizeof inode->data.inode_index);
+  inode->data.count = 0;
+  inode->data.level = 0;
+  inode->data.spilled = true;
+  if (!index_growth (&inode->data, extent_blocks (old) * FS_BLOCK_SIZE))
+    {
+      index_release (&inode->data);
+      inode->data = *old;
+      free (old);
+      return false;
+    }
+  inode->data.length = old->length;
+  for (i = 0; i < old->count; i++)
+    for (j = 0; j < old->extents[i].length; j++, idx++)
+      if (old->extents[i].start != 0)
+        index_set (inode, idx, old->extents[i].start + j * block_sectors);
+  lock_acquire (&inode->index_lock);
+  index_invalidate (inode);
+  lock_release (&inode->index_lock);
+  cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+  free (old);
+  return true;
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) 
 {
-  struct list_elem *e;
+  static struct inode key;      /* Too big for the stack; under inode_table_lock. */
   struct inode *inode;
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  struct hash_elem *e;
+  /* Check whether this inode is already open or recently closed. */
+  lock_acquire (&inode_table_lock);
+  key.sector = sector;
+  e = hash_find (&inode_table, &key.hash_elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, hash_elem);
+      if (inode->open_cnt == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->elem);
+          closed_cnt--;
         }
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&inode_loaded, &inode_table_lock);
+      lock_release (&inode_table_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inode_table_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
+  hash_insert (&inode_table, &inode->hash_elem);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->loading = true;
+  inode->index = NULL;
+  rwlock_init (&inode->rw);
+  lock_init (&inode->index_lock);
+  lock_release (&inode_table_lock);
+
+  /* Later openers find it loading and wait. */
   cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+  lock_acquire (&inode_table_lock);
+  inode->loading = false;
+  cond_broadcast (&inode_loaded, &inode_table_lock);
+  lock_release (&inode_table_lock);
   return inode;
 }
 
@@ -314,7 +909,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inode_table_lock);
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+    }
   return inode;
 }
 
@@ -335,20 +934,33 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
   bool flag = inode->sector == 4023;
+  lock_acquire (&inode_table_lock);
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
-          inode_delete(inode->sector);
+          /* No one can find it once it is out of the table, so
+             its blocks are freed without the lock. */
+          hash_delete (&inode_table, &inode->hash_elem);
+          lock_release (&inode_table_lock);
+          inode_delete (inode->sector);
+          free (inode->index);
+          free (inode);
+          return;
         }
 
-      free (inode); 
+      /* Keep it around in case it is reopened soon. */
+      list_push_back (&closed_inodes, &inode->elem);
+      if (++closed_cnt > CLOSED_INODE_MAX)
+        {
+          closed_cnt--;
+          inode_free (list_entry (list_pop_front (&closed_inodes),
+                                  struct inode, elem));
+        }
     }
+  lock_release (&inode_table_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -357,7 +969,21 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inode_table_lock);
   inode->removed = true;
+  lock_release (&inode_table_lock);
+}
+
+/* Returns how many of the next CNT sectors of INODE, starting
+   with SECTOR at byte OFFSET, are consecutive on disk. */
+static size_t
+sector_run (struct inode *inode, off_t offset, disk_sector_t sector, size_t cnt)
+{
+  size_t run = 1;
+  while (run < cnt
+         && byte_to_sector (inode, offset + run * DISK_SECTOR_SIZE) == sector + run)
+    run++;
+  return run;
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -368,9 +994,19 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  if(offset>=inode->data.length)
-    return 0;
 
+  rwlock_acquire_read (&inode->rw);
+  if (inode->data.is_inline)
+    {
+      if (offset < inode->data.length)
+        {
+          bytes_read = inode->data.length - offset < size
+                       ? inode->data.length - offset : size;
+          memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        }
+      rwlock_release_read (&inode->rw);
+      return bytes_read;
+    }
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -387,34 +1023,68 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      if (sector_idx == 0)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else if (chunk_size == DISK_SECTOR_SIZE)
+        {
+          /* Read whole sectors that are consecutive on disk as one
+             run. */
+          off_t left = size < inode_left ? size : inode_left;
+          size_t cnt = sector_run (inode, offset, sector_idx,
+                                   left / DISK_SECTOR_SIZE);
+          cache_read_run (sector_idx, cnt, buffer + bytes_read);
+          chunk_size = cnt * DISK_SECTOR_SIZE;
+        }
+      else
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
+  rwlock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+/* Hands the CNT sectors of INODE starting at byte OFFSET to the
+   read-ahead thread.  Stops at end of file. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, int cnt)
+{
+  rwlock_acquire_read (&inode->rw);
+  for (; cnt > 0 && offset < inode_length (inode) && !inode->data.is_inline;
+       cnt--, offset += DISK_SECTOR_SIZE)
+    {
+      disk_sector_t sector_idx = byte_to_sector (inode, offset);
+      if (sector_idx != 0 && sector_idx != (disk_sector_t) -1)
+        cache_read_ahead (sector_idx);
+    }
+  rwlock_release_read (&inode->rw);
+}
+
+/* Writes SIZE bytes from BUFFER into the data sectors of
+   INODE, which is not inline, growing it as needed.  The caller
+   holds INODE's lock for writing. */
+static off_t
+write_sectors (struct inode *inode, const uint8_t *buffer, off_t size,
+               off_t offset)
 {
-  const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  if (inode->deny_write_cnt)
-    return 0;
+
   if(offset + size > inode->data.length){ //growth
-    if(!inode_growth(&inode->data, inode->sector, offset + size, INODE_MAX_LEVEL, inode->data.is_dir))
+    lock_acquire(&inode->index_lock);
+    index_invalidate(inode);
+    lock_release(&inode->index_lock);
+    if(is_extent(&inode->data)
+       && !extent_growth(&inode->data, bytes_to_blocks(offset + size))
+       && !extent_spill(inode))
+      return 0;
+    if(!is_extent(&inode->data) && !index_growth(&inode->data, offset + size))
       return 0;
     inode->data.length = offset + size;
+    cache_write(inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
   }
 
   while (size > 0) 
@@ -432,6 +1102,13 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       int chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
+      if (sector_idx == 0)
+        {
+          sector_idx = inode_fill (inode, offset, size);
+          if (sector_idx == 0)
+            break;
+          sector_idx += offset % FS_BLOCK_SIZE / DISK_SECTOR_SIZE;
+        }
       
       cache_write (sector_idx, buffer + bytes_written, sector_ofs, chunk_size); 
 
@@ -444,13 +1121,85 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   return bytes_written;
 }
 
+/* Moves the data of inline INODE out to data sectors in the
+   layout recorded in its FORMAT.  Returns false if memory or
+   disk space runs out, leaving INODE inline. */
+static bool
+inode_uninline (struct inode *inode)
+{
+  off_t length = inode->data.length;
+  uint8_t *data = malloc (INLINE_MAX);
+  bool success;
+
+  if (data == NULL)
+    return false;
+  memcpy (data, inode->data.inline_data, INLINE_MAX);
+  memset (inode->data.inline_data, 0, INLINE_MAX);
+  inode->data.is_inline = false;
+  inode->data.count = 0;
+  inode->data.length = 0;
+  success = write_sectors (inode, data, length, 0) == length;
+  if (!success)
+    {
+      /* Give back whatever was allocated. */
+      if (is_extent (&inode->data))
+        extent_truncate (&inode->data, 0);
+      else
+        index_release (&inode->data);
+      memcpy (inode->data.inline_data, data, INLINE_MAX);
+      inode->data.is_inline = true;
+      inode->data.spilled = false;
+      inode->data.level = 0;
+      inode->data.count = 0;
+      inode->data.length = length;
+    }
+  cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+  free (data);
+  return success;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if end of file is reached or an error occurs.
+   An inline inode that would grow past INLINE_MAX is first
+   converted to its regular layout. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  rwlock_acquire_write (&inode->rw);
+  if (inode->deny_write_cnt)
+    goto done;
+  if (inode->data.is_inline && offset + size <= (off_t) INLINE_MAX)
+    {
+      memcpy (inode->data.inline_data + offset, buffer, size);
+      if (offset + size > inode->data.length)
+        inode->data.length = offset + size;
+      cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+      bytes_written = size;
+      goto done;
+    }
+  if (inode->data.is_inline && !inode_uninline (inode))
+    goto done;
+  bytes_written = write_sectors (inode, buffer, size, offset);
+
+ done:
+  rwlock_release_write (&inode->rw);
+  return bytes_written;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -459,9 +1208,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -484,10 +1235,43 @@ int inode_parent_number(struct inode *inode){
 }
 
 void inode_set_parent(struct inode *inode, disk_sector_t parent_sector){
+  rwlock_acquire_write(&inode->rw);
   inode->data.parent_sector = parent_sector;
   cache_write(inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+  rwlock_release_write(&inode->rw);
+}
+
+bool inode_is_hashed(struct inode *inode){
+  return inode->data.buckets != 0;
+}
+
+/* Returns the number of buckets of hashed directory INODE. */
+size_t inode_buckets(struct inode *inode){
+  return inode->data.buckets;
+}
+
+/* Makes directory INODE hashed with BUCKETS buckets. */
+void inode_set_buckets(struct inode *inode, size_t buckets){
+  rwlock_acquire_write(&inode->rw);
+  inode->data.buckets = buckets;
+  cache_write(inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+  rwlock_release_write(&inode->rw);
 }
 
 bool inode_removed(struct inode *inode){
   return inode->removed;
 }
+
+/* Returns the format of the inode in SECTOR. */
+enum inode_format inode_format_of(disk_sector_t sector){
+  struct inode_disk disk_inode;
+  cache_read(sector, &disk_inode, 0, DISK_SECTOR_SIZE);
+  return disk_inode.format;
+}
+
+/* Returns the sectors per block recorded in the inode in SECTOR. */
+unsigned inode_block_sectors_of(disk_sector_t sector){
+  struct inode_disk disk_inode;
+  cache_read(sector, &disk_inode, 0, DISK_SECTOR_SIZE);
+  return disk_inode.block_sectors != 0 ? disk_inode.block_sectors : 1;
+}
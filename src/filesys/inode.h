@@ -8,8 +8,16 @@
 #define INODE_MAX_LEVEL 2
 struct bitmap;
 
+/* On-disk inode formats. */
+enum inode_format
+  {
+    INODE_INDEXED,              /* Multilevel index of blocks. */
+    INODE_EXTENT                /* Runs of contiguous blocks. */
+  };
+extern enum inode_format inode_format;
+
 void inode_init (void);
-bool inode_create (disk_sector_t, off_t, int, bool);
+bool inode_create (disk_sector_t, off_t, bool is_dir);
 void inode_delete(disk_sector_t sector);
 struct inode *inode_open (disk_sector_t);
 struct inode *inode_reopen (struct inode *);
@@ -17,6 +25,7 @@ disk_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t offset, int cnt);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
@@ -25,6 +34,11 @@ bool inode_is_dir (struct inode *);
 int inode_number(struct inode *inode);
 int inode_parent_number(struct inode *inode);
 void inode_set_parent(struct inode *inode, disk_sector_t parent_sector);
+bool inode_is_hashed(struct inode *inode);
+size_t inode_buckets(struct inode *inode);
+void inode_set_buckets(struct inode *inode, size_t buckets);
 bool inode_removed(struct inode *inode);
+enum inode_format inode_format_of(disk_sector_t sector);
+unsigned inode_block_sectors_of(disk_sector_t sector);
 
 #endif /* filesys/inode.h */
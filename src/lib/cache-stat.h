@@ -0,0 +1,28 @@
+#ifndef __LIB_CACHE_STAT_H
+#define __LIB_CACHE_STAT_H
+
+#include <stdint.h>
+
+/* Number of buckets in the buffer cache latency histogram.
+   Bucket I counts operations that took fewer than
+   2**(I + CACHE_HIST_SHIFT) CPU cycles (and at least half that
+   many, except for bucket 0); the last bucket also takes
+   everything slower. */
+#define CACHE_HIST_BUCKETS 16
+#define CACHE_HIST_SHIFT 9
+
+/* Buffer cache statistics, as printed at power off and returned
+   by the cache_stat system call. */
+struct cache_stat
+  {
+    uint64_t hits;              /* Lookups found in the cache. */
+    uint64_t misses;            /* Lookups not found in the cache. */
+    uint64_t read_aheads;       /* Sectors loaded by read-ahead. */
+    uint64_t evictions;         /* Entries dropped to make room. */
+    uint64_t write_backs;       /* Dirty sectors written to disk. */
+    uint64_t lock_waits;        /* Contended cache lock acquisitions. */
+    uint64_t lock_wait_cycles;  /* CPU cycles spent waiting for it. */
+    uint64_t latency[CACHE_HIST_BUCKETS]; /* Operation latency histogram. */
+  };
+
+#endif /* lib/cache-stat.h */
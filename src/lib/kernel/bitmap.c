@@ -28,6 +28,7 @@ struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    size_t next;        /* Where bitmap_scan_and_flip_next() starts. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -68,6 +69,31 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or B's bit count if there is none.  Works a
+   whole element at a time, skipping elements that hold no such
+   bit and finding the bit in the first one that does with a
+   single bit scan. */
+static size_t
+find_value (const struct bitmap *b, size_t start, bool value)
+{
+  size_t idx = elem_idx (start);
+  elem_type flip = value ? 0 : (elem_type) -1;
+  elem_type e;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+  e = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+  while (e == 0)
+    {
+      if (++idx >= elem_cnt (b->bit_cnt))
+        return b->bit_cnt;
+      e = b->bits[idx] ^ flip;
+    }
+  start = idx * ELEM_BITS + __builtin_ctzl (e);
+  return start < b->bit_cnt ? start : b->bit_cnt;
+}
 
 /* Creation and destruction. */
 
@@ -82,6 +108,7 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
+      b->next = 0;
       b->bits = malloc (byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
@@ -104,6 +131,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
   ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
   b->bit_cnt = bit_cnt;
+  b->next = 0;
   b->bits = (elem_type *) (b + 1);
   bitmap_set_all (b, false);
   return b;
@@ -251,16 +279,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_value (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -299,13 +322,26 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      /* Jump from each run of VALUE bits to the end of it until
+         one is long enough. */
+      for (;;)
+        {
+          size_t end;
+          i = find_value (b, i, value);
+          if (i > last)
+            break;
+          end = find_value (b, i, !value);
+          if (end - i >= cnt)
+            return i;
+          i = end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -325,6 +361,22 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
 }
+
+/* Like bitmap_scan_and_flip(), but next-fit: starts where the
+   previous call left off and wraps around to the beginning of B
+   before giving up, so that repeated allocations do not rescan
+   the bits they have already used up. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value)
+{
+  size_t start = b->next < b->bit_cnt ? b->next : 0;
+  size_t idx = bitmap_scan_and_flip (b, start, cnt, value);
+  if (idx == BITMAP_ERROR && start > 0)
+    idx = bitmap_scan_and_flip (b, 0, cnt, value);
+  if (idx != BITMAP_ERROR)
+    b->next = idx + cnt;
+  return idx;
+}
 
 /* File input and output. */
 
@@ -359,6 +411,22 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B's file image that start at byte OFS
+   to the same place in FILE, stopping at the end of the image.
+   Return true if successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  size_t end = byte_cnt (b->bit_cnt);
+  if (ofs >= end)
+    return true;
+  if (size > end - ofs)
+    size = end - ofs;
+  return file_write_at (file, (const char *) b->bits + ofs, size, ofs)
+         == (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -182,3 +182,9 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+cache_stat (struct cache_stat *stat)
+{
+  return syscall1 (SYS_CACHE_STAT, stat);
+}
@@ -0,0 +1,45 @@
+/* Reads a file twice and checks that the cache_stat system
+   call reports the second read as cache hits. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[2048];
+
+static void
+read_file (const char *file_name)
+{
+  int fd;
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (read (fd, buf, sizeof buf) == (int) sizeof buf,
+         "read \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  struct cache_stat before, after;
+  int fd;
+
+  CHECK (create (file_name, sizeof buf), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  read_file (file_name);
+  CHECK (cache_stat (&before), "cache_stat");
+  read_file (file_name);
+  CHECK (cache_stat (&after), "cache_stat");
+  if (after.hits < before.hits + sizeof buf / 512)
+    fail ("second read made %llu cache hits, expected at least %zu",
+          after.hits - before.hits, sizeof buf / 512);
+
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-stat) begin
+(cache-stat) create "testfile"
+(cache-stat) open "testfile"
+(cache-stat) write "testfile"
+(cache-stat) close "testfile"
+(cache-stat) open "testfile"
+(cache-stat) read "testfile"
+(cache-stat) close "testfile"
+(cache-stat) cache_stat
+(cache-stat) open "testfile"
+(cache-stat) read "testfile"
+(cache-stat) close "testfile"
+(cache-stat) cache_stat
+(cache-stat) remove "testfile"
+(cache-stat) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($a);
+$a->{"file$_"} = [''] foreach 0...99;
+check_archive ({"a" => $a});
+pass;
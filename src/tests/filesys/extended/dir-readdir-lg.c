@@ -0,0 +1,49 @@
+/* Creates more files in one directory than fit before it is
+   converted to hashed buckets, then checks that readdir() returns
+   each of them exactly once. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 100
+
+static bool seen[FILE_CNT];
+
+void
+test_main (void) 
+{
+  char name[READDIR_MAX_LEN + 1];
+  size_t i, cnt = 0;
+  int fd;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  msg ("creating %d files in \"a\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char file_name[32];
+      snprintf (file_name, sizeof file_name, "a/file%zu", i);
+      if (!create (file_name, 0))
+        fail ("create \"%s\" failed", file_name);
+    }
+
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  msg ("readdir \"a\"");
+  while (readdir (fd, name))
+    {
+      int n = atoi (name + 4);
+      if (memcmp (name, "file", 4) || n < 0 || n >= FILE_CNT)
+        fail ("readdir returned unexpected name \"%s\"", name);
+      if (seen[n])
+        fail ("readdir returned \"%s\" twice", name);
+      seen[n] = true;
+      cnt++;
+    }
+  if (cnt != FILE_CNT)
+    fail ("readdir returned %zu names, expected %d", cnt, FILE_CNT);
+  msg ("close \"a\"");
+  close (fd);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-readdir-lg) begin
+(dir-readdir-lg) mkdir "a"
+(dir-readdir-lg) creating 100 files in "a"
+(dir-readdir-lg) open "a"
+(dir-readdir-lg) readdir "a"
+(dir-readdir-lg) close "a"
+(dir-readdir-lg) end
+EOF
+pass;
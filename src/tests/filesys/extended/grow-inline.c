@@ -0,0 +1,33 @@
+/* Creates a 10-byte file, small enough to be stored inside its
+   inode, then grows it past 400 bytes and checks that the first
+   10 bytes survived the move to data blocks. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[510];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  size_t i;
+  int fd;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = 'a' + i % 26;
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, 10) == 10, "write 10 bytes to \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  seek (fd, 10);
+  CHECK (write (fd, buf + 10, sizeof buf - 10) == (int) sizeof buf - 10,
+         "write %zu more bytes to \"%s\"", sizeof buf - 10, file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
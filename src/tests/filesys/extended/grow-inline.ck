@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-inline) begin
+(grow-inline) create "testfile"
+(grow-inline) open "testfile"
+(grow-inline) write 10 bytes to "testfile"
+(grow-inline) close "testfile"
+(grow-inline) open "testfile"
+(grow-inline) write 500 more bytes to "testfile"
+(grow-inline) close "testfile"
+(grow-inline) open "testfile" for verification
+(grow-inline) verified contents of "testfile"
+(grow-inline) close "testfile"
+(grow-inline) end
+EOF
+pass;
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"testfile" => ["0123456789" . "\0" x 149990 . "0123456789"]});
+pass;
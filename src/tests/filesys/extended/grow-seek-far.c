@@ -0,0 +1,31 @@
+/* Writes a few bytes, seeks far past the end of the file, and
+   writes a few more, then checks that the gap reads back as
+   zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define GAP 150000
+
+static char buf[GAP + 10];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  memcpy (buf, "0123456789", 10);
+  memcpy (buf + GAP, "0123456789", 10);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, 10) == 10, "write \"%s\"", file_name);
+  msg ("seek \"%s\" to %d", file_name, GAP);
+  seek (fd, GAP);
+  CHECK (write (fd, buf + GAP, 10) == 10, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-seek-far) begin
+(grow-seek-far) create "testfile"
+(grow-seek-far) open "testfile"
+(grow-seek-far) write "testfile"
+(grow-seek-far) seek "testfile" to 150000
+(grow-seek-far) write "testfile"
+(grow-seek-far) close "testfile"
+(grow-seek-far) open "testfile" for verification
+(grow-seek-far) verified contents of "testfile"
+(grow-seek-far) close "testfile"
+(grow-seek-far) end
+EOF
+pass;
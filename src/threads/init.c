@@ -31,8 +31,10 @@
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
 #endif
 #include "vm/frame.h"
 #include "vm/swap.h"
@@ -243,6 +245,39 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-inode-format"))
+        {
+          if (value != NULL && !strcmp (value, "indexed"))
+            inode_format = INODE_INDEXED;
+          else if (value != NULL && !strcmp (value, "extent"))
+            inode_format = INODE_EXTENT;
+          else
+            PANIC ("unknown inode format `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-block-size"))
+        {
+          int size = value != NULL ? atoi (value) : 0;
+          if (size < DISK_SECTOR_SIZE || size > BLOCK_SECTORS_MAX * DISK_SECTOR_SIZE
+              || size % DISK_SECTOR_SIZE != 0
+              || (size / DISK_SECTOR_SIZE & (size / DISK_SECTOR_SIZE - 1)) != 0)
+            PANIC ("bad block size `%s' (use -h for help)", value);
+          block_sectors = size / DISK_SECTOR_SIZE;
+        }
+      else if (!strcmp (name, "-cache"))
+        cache_size = atoi (value);
+      else if (!strcmp (name, "-flush"))
+        cache_flush_interval = atoi (value);
+      else if (!strcmp (name, "-dirty"))
+        cache_dirty_ratio = atoi (value);
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (value != NULL && !strcmp (value, "clock"))
+            cache_policy = CACHE_CLOCK;
+          else if (value != NULL && !strcmp (value, "2q"))
+            cache_policy = CACHE_2Q;
+          else
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -351,6 +386,14 @@ usage (void)
           "  -h                 Print this help message and power off.\n"
           "  -q                 Power off VM after actions or on panic.\n"
           "  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+          "  -inode-format=FMT  With -f, use FMT inodes: indexed (default) or extent.\n"
+          "  -block-size=BYTES  With -f, use BYTES-byte blocks: 512 (default) to 4096.\n"
+          "  -cache=N           Let the buffer cache hold up to N sectors.\n"
+          "  -flush=MS          Write back dirty cache blocks every MS ms (0=off).\n"
+          "  -dirty=PCT         Write back early once PCT%% of the cache is dirty.\n"
+          "  -cache-policy=POL  Use cache replacement POL: clock (default) or 2q.\n"
+#endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
@@ -393,6 +436,7 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   disk_print_stats ();
+  cache_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
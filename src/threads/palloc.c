@@ -11,6 +11,9 @@
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#ifdef FILESYS
+#include "filesys/cache.h"
+#endif
 
 /* Page allocator.  Hands out memory in page-size (or
    page-multiple) chunks.  See malloc.h for an allocator that
@@ -85,9 +88,21 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
     return NULL;
 
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  page_idx = bitmap_scan_and_flip_next (pool->used_map, page_cnt, false);
   lock_release (&pool->lock);
 
+#ifdef FILESYS
+  /* The buffer cache grows into spare kernel pages, so ask it to
+     give some back before failing. */
+  if (page_idx == BITMAP_ERROR && pool == &kernel_pool
+      && cache_shrink (page_cnt) > 0)
+    {
+      lock_acquire (&pool->lock);
+      page_idx = bitmap_scan_and_flip_next (pool->used_map, page_cnt, false);
+      lock_release (&pool->lock);
+    }
+#endif
+
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
   else
@@ -120,6 +135,13 @@ palloc_get_page (enum palloc_flags flags)
   return palloc_get_multiple (flags, 1);
 }
 
+/* Returns the number of pages in the kernel pool. */
+size_t
+palloc_kernel_pages (void)
+{
+  return bitmap_size (kernel_pool.used_map);
+}
+
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) 
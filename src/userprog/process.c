@@ -170,14 +170,12 @@ process_exit (void)
     sys_munmap(m->mmap_id);
   }
 
-  lock_acquire(&file_lock);
   for(e = list_begin(&curr->file_list); e != list_end(&curr->file_list);){
     del_file_fd = list_entry(e, struct file_fd, elem);
     file_close(del_file_fd->file);
     e = list_remove(e);
     palloc_free_page(del_file_fd);
   }
-  lock_release(&file_lock);
 
   for(e = list_begin(&curr->child_list); e != list_end(&curr->child_list);){
     process = list_entry(e, struct process_stat, elem);
@@ -196,11 +194,8 @@ process_exit (void)
     palloc_free_page(process);
   }
 
-  if(curr->exec_file != NULL){
-    lock_acquire(&file_lock);
+  if(curr->exec_file != NULL)
     file_close(curr->exec_file);
-    lock_release(&file_lock);
-  }
   dir_close(curr->dir);
   page_table_destroy(&curr->page_table);
   /* Destroy the current process's page directory and switch back
@@ -328,11 +323,10 @@ load (const char *file_name, void (**eip) (void), void **esp)
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
-    goto done_nolock;
+    goto done;
   process_activate ();
  
   /* Open executable file. */
-  lock_acquire(&file_lock);
   word = strtok_r(file_save, " ", &brkt);
   file = filesys_open (word);
   if (file == NULL) 
@@ -456,8 +450,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
   success = true;
  done:
   /* We arrive here whether the load is successful or not. */
-  lock_release(&file_lock);
- done_nolock:
   palloc_free_page (file_save); 
   return success;
 }
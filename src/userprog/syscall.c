@@ -16,6 +16,7 @@
 #include "filesys/inode.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/cache.h"
 #include "devices/input.h"
 #include "vm/page.h"
 #include "vm/frame.h"
@@ -25,7 +26,6 @@ static void syscall_handler (struct intr_frame *);
 void
 syscall_init (void) 
 {
-  lock_init(&file_lock);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -283,6 +283,15 @@ syscall_handler (struct intr_frame *f UNUSED)
       f->eax = sys_inumber(fd);
       break;
     }
+    case SYS_CACHE_STAT:
+    {
+      struct cache_stat *stat;
+      check_vaddr(f->esp+4);
+      memcpy(&stat, f->esp+4, sizeof(struct cache_stat *));
+      check_buffer(stat, sizeof *stat, true);
+      f->eax = sys_cache_stat(stat);
+      break;
+    }
     default:
     sys_exit(-1);
     break;
@@ -316,25 +325,19 @@ int sys_wait (pid_t pid)
 
 bool sys_create (const char *file, unsigned initial_size)
 {
-  lock_acquire(&file_lock);
   bool ret = filesys_create(file, initial_size);
-  lock_release(&file_lock);
   return ret;
 }
 
 bool sys_remove (const char *file)
 {
-  lock_acquire(&file_lock);
   bool ret = filesys_remove(file);
-  lock_release(&file_lock);
   return ret;
 }
 
 int sys_open (const char *file)
 {
-  lock_acquire(&file_lock);
   struct file *open_file = filesys_open(file);
-  lock_release(&file_lock);
   if(open_file == NULL)
     return -1;
   struct thread *t = thread_current();
@@ -359,9 +362,7 @@ int sys_filesize (int fd)
   struct file *open_file = get_file(fd);
   if(open_file == NULL)
     return -1;
-  lock_acquire(&file_lock);
   int ret = file_length(open_file);
-  lock_release(&file_lock);
   return ret;
 }
 
@@ -377,9 +378,7 @@ int sys_read (int fd, void *buffer, unsigned size)
   struct file *open_file = get_file(fd);
   if(open_file == NULL)
     return -1;
-  lock_acquire(&file_lock);
   int ret = file_read(open_file, buffer, size);
-  lock_release(&file_lock);
   return ret;
 }
 
@@ -396,9 +395,7 @@ int sys_write (int fd, const void *buffer, unsigned size)
   struct dir *open_dir = get_dir(fd);
   if(open_dir != NULL)
     return -1;
-  lock_acquire(&file_lock);
   int ret = file_write(open_file, buffer, size);
-  lock_release(&file_lock);
   return ret;
 }
 
@@ -407,9 +404,7 @@ void sys_seek (int fd, unsigned position)
   struct file *open_file = get_file(fd);
   if(open_file == NULL)
     return ;
-  lock_acquire(&file_lock);
   file_seek(open_file, position);
-  lock_release(&file_lock);
 }
 
 unsigned sys_tell (int fd)
@@ -417,9 +412,7 @@ unsigned sys_tell (int fd)
   struct file *open_file = get_file(fd);
   if(open_file == NULL)
     return -1;
-  lock_acquire(&file_lock);
   unsigned ret = file_tell(open_file);
-  lock_release(&file_lock);
   return ret;
 }
 
@@ -432,11 +425,9 @@ void sys_close (int fd)
   for(e = list_begin(&t->file_list); e != list_end(&t->file_list); e = list_next(e)){
     del_file_fd = list_entry(e, struct file_fd, elem);
     if(del_file_fd->fd == fd){
-      lock_acquire(&file_lock);
       file_close(del_file_fd->file);
       if(del_file_fd->dir != NULL)
         dir_close(del_file_fd->dir);
-      lock_release(&file_lock);
       list_remove(e);
       palloc_free_page(del_file_fd);
       break;
@@ -456,10 +447,8 @@ mapid_t sys_mmap(int fd, void *addr)
   off_t ofs = 0;
   if(file == NULL)
     return -1;
-  lock_acquire(&file_lock);
   file = file_reopen(file);
   read_bytes = file_length(file);
-  lock_release(&file_lock);
   if(file == NULL || read_bytes == 0)
     return -1;
   size = read_bytes;
@@ -506,7 +495,6 @@ void sys_munmap(mapid_t mapping)
   struct mmap_entry *m = list_entry(e, struct mmap_entry, elem);
   struct page_entry *p;
   off_t ofs = 0;
-  lock_acquire(&file_lock);
   while (m->size > 0)
     {
       p = page_find(&t->page_table, m->addr);
@@ -525,34 +513,25 @@ void sys_munmap(mapid_t mapping)
       m->addr += PGSIZE;
     }
   file_close(m->file);
-  lock_release(&file_lock);
   free(m);
 }
 
 bool sys_chdir(const char *dir){
-  lock_acquire(&file_lock);
   struct dir *new_dir = get_directory(dir, false);
-  if(new_dir == NULL){
-    lock_release(&file_lock);
+  if(new_dir == NULL)
     return false;
-  }
   if(thread_current()->dir != NULL)
     dir_close(thread_current()->dir);
   thread_current()->dir = new_dir;
-  lock_release(&file_lock);
   return true;
 }
 
 bool sys_mkdir(const char *dir){
-  lock_acquire(&file_lock);
   struct dir *parent_dir = get_directory(dir, true);
-  if(parent_dir == NULL){
-    lock_release(&file_lock);
+  if(parent_dir == NULL)
     return false;
-  }
   char *filename = get_filename(dir);
   if(*filename == '\0'){
-    lock_release(&file_lock);
     dir_close(parent_dir);
     free(filename);
     return false;
@@ -560,7 +539,8 @@ bool sys_mkdir(const char *dir){
   disk_sector_t inode_sector = -1;
   struct inode *inode;
   bool success = !dir_lookup(parent_dir, filename, &inode) 
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (1, inode_get_inumber (dir_get_inode (parent_dir)),
+                                             &inode_sector)
                   && dir_create(inode_sector, 16, inode_number(dir_get_inode(parent_dir)))
                   && dir_add (parent_dir, filename, inode_sector);
 
@@ -568,7 +548,6 @@ bool sys_mkdir(const char *dir){
   free(filename);
   if(!success && inode_sector != -1)
     free_map_release(&inode_sector, 1);
-  lock_release(&file_lock);
   return success;
 }
 
@@ -577,9 +556,7 @@ bool sys_readdir(int fd, char *name){
   struct dir *open_dir = get_dir(fd);
   if(open_file == NULL || open_dir == NULL)
     return false;
-  lock_acquire(&file_lock);
   bool ret = dir_readdir(open_dir, name);
-  lock_release(&file_lock);
   return ret;
 }
 
@@ -595,9 +572,14 @@ int sys_inumber(int fd){
   struct file *open_file = get_file(fd);
   if(open_file == NULL)
     return -1;
-  lock_acquire(&file_lock);
   int ret = inode_number(file_get_inode(open_file));
-  lock_release(&file_lock);
   return ret;
 }
 
+bool sys_cache_stat(struct cache_stat *stat){
+  struct cache_stat snapshot;
+  /* Copy out without cache_lock: faulting on STAT may need the cache. */
+  cache_get_stat(&snapshot);
+  memcpy(stat, &snapshot, sizeof snapshot);
+  return true;
+}
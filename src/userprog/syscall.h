@@ -1,6 +1,7 @@
 #include <stdbool.h>
 #include "threads/synch.h"
 #include "filesys/directory.h"
+#include <cache-stat.h>
 #include <list.h>
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
@@ -15,8 +16,6 @@ struct file_fd{
   struct list_elem elem;
 };
 
-struct lock file_lock;
-
 void syscall_init (void);
 
 void sys_halt (void);
@@ -39,5 +38,6 @@ bool sys_mkdir(const char *dir);
 bool sys_readdir(int fd, char *name);
 bool sys_isdir(int fd);
 int sys_inumber(int fd);
+bool sys_cache_stat(struct cache_stat *stat);
 
 #endif /* userprog/syscall.h */
@@ -24,10 +24,8 @@ void page_action_func(struct hash_elem *hash_elem, void *aux UNUSED){
     swap_free(p->swap_index);
   else if(p->status == FRAME_MMAP){
     p->pin = true;
-    lock_acquire(&file_lock);
     if(thread_current()->pagedir != NULL && pagedir_is_dirty(thread_current()->pagedir, p->page))
       file_write_at(p->file, p->page, p->read_bytes, p->offset);
-    lock_release(&file_lock);
   }
   free(p);
 }
@@ -125,8 +123,8 @@ bool page_load(struct hash *page_table, void *addr, uint32_t *pagedir){
       if (kpage == NULL)
         return false;
 
-      file_seek(p->file, p->offset);
-      if (file_read (p->file, kpage, p->read_bytes) != (int) p->read_bytes)
+      /* Positional read: page faults do no file read-ahead. */
+      if (file_read_at (p->file, kpage, p->read_bytes, p->offset) != (int) p->read_bytes)
         {
           frame_free (kpage);
           return false; 
@@ -151,8 +149,8 @@ bool page_load(struct hash *page_table, void *addr, uint32_t *pagedir){
       if (kpage == NULL)
         return false;
 
-      file_seek(p->file, p->offset);
-      if (file_read (p->file, kpage, p->read_bytes) != (int) p->read_bytes)
+      /* Positional read: page faults do no file read-ahead. */
+      if (file_read_at (p->file, kpage, p->read_bytes, p->offset) != (int) p->read_bytes)
         {
           frame_free (kpage);
           return false; 
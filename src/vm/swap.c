@@ -34,7 +34,7 @@ void swap_free(size_t swap_index){
 
 size_t swap_out(void *addr){ // memory -> disk
   lock_acquire(&swap_lock);
-  size_t swap_index = bitmap_scan_and_flip(swap_bitmap, 0, SECTOR_NUM, 0);
+  size_t swap_index = bitmap_scan_and_flip_next(swap_bitmap, SECTOR_NUM, 0);
   int i;
   if(swap_index == BITMAP_ERROR)
     PANIC("no space in disk");